@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,84 +12,260 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To overlap disk I/O with other work, start it with bsubmit,
+//     or submit a batch with bsubmitwait and wait for it with bwait.
 //
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// The cache takes 1/BCACHEFRAC of the memory free at boot (at least
+// NBUF buffers). Buffers are hashed by (dev, blockno) into chains, each
+// with its own lock, so lookups of different blocks don't contend.
+// bcache.lock is only taken to pick and rehash a buffer to recycle;
+// holding it is what allows taking a second bucket lock without deadlock.
+//
+// Buffers to recycle are chosen by a CLOCK approximation of 2Q:
+// a newly read block is "cold" and is recycled the next time the
+// clock hand passes it, unless it was looked up again meanwhile,
+// in which case it becomes "hot". A hot buffer must go a whole
+// turn of the hand unused before it is cold again. Blocks read only
+// once, e.g. by a scan through large files, thus can't push out the
+// blocks that are used over and over.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
-struct {
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  // Buffers hashed here, through prev/next.
+  struct buf *head;
+} __attribute__((aligned(CACHELINE)));
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock __attribute__((aligned(CACHELINE)));
+  uint nbuf;
+  uint nhot;             // number of hot buffers
+  struct buf *hand;      // clock hand, into the ring through clocknext
+  int nwait;             // processes in bget waiting for a free buffer
+  uint nbucket;
+  struct bucket *bucket;
 } bcache;
 
+static struct bucket*
+bucketof(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 7 + blockno) % bcache.nbucket];
+}
+
+// Caller holds bk->lock.
+static void
+bucketinsert(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->head;
+  if(b->next)
+    b->next->prev = b;
+  bk->head = b;
+}
+
+// Caller holds bk->lock.
+static void
+bucketremove(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+}
+
+// Return b from bk with a reference, or 0. Caller holds bk->lock.
+static struct buf*
+bucketfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      // The first lookup of a block read ahead is its first real use.
+      if(b->ahead)
+        b->ahead = 0;
+      else
+        b->used = 1;
+      return b;
+    }
+  }
+  return 0;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct buf *b, *last;
+  char *mem;
+  uint i, j, perpage, order;
 
   initlock(&bcache.lock, "bcache");
 
+  perpage = PGSIZE / sizeof(struct buf);
+  bcache.nbuf = kfreecount() / BCACHEFRAC * perpage;
+  if(bcache.nbuf < NBUF)
+    bcache.nbuf = NBUF;
+
+  // About 8 buffers per hash chain.
+  for(order = 0; order < KMAXORDER; order++)
+    if((PGSIZE << order) / sizeof(struct bucket) >= bcache.nbuf / 8)
+      break;
+  if((bcache.bucket = (struct bucket*)kallocpages(order)) == 0)
+    panic("binit");
+  bcache.nbucket = (PGSIZE << order) / sizeof(struct bucket);
+  for(i = 0; i < bcache.nbucket; i++){
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+    bcache.bucket[i].head = 0;
+  }
+
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // All buffers start out cold, holding no block,
+  // and are linked into the clock ring.
+  last = 0;
+  for(i = 0; i < bcache.nbuf; ){
+    if((mem = kalloc()) == 0)
+      panic("binit");
+    memset(mem, 0, PGSIZE);
+    for(j = 0; j < perpage && i < bcache.nbuf; j++, i++){
+      b = (struct buf*)mem + j;
+      initsleeplock(&b->lock, "buffer");
+      b->dev = -1;
+      bucketinsert(bucketof(b->dev, b->blockno), b);
+      if(last)
+        last->clocknext = b;
+      else
+        bcache.hand = b;
+      last = b;
+    }
   }
+  last->clocknext = bcache.hand;
+}
+
+// Advance the clock hand to an unused, clean, cold buffer and
+// return it with its bucket's lock held, in *bkp.
+// Returns 0 if the hand went around without finding one.
+// Caller holds bcache.lock.
+static struct buf*
+bvictim(struct bucket **bkp)
+{
+  struct buf *b;
+  struct bucket *bk;
+  uint n;
+
+  // One turn may only age buffers: hot to cold, then cold to recyclable.
+  for(n = 0; n < 3*bcache.nbuf; n++){
+    b = bcache.hand;
+    bcache.hand = b->clocknext;
+    // Even if refcnt==0, B_DIRTY indicates a buffer is in use
+    // because log.c has modified it but not yet committed it.
+    if(b->refcnt != 0 || (b->flags & B_DIRTY) != 0)
+      continue;
+    if(b->used){
+      b->used = 0;
+      if(!b->hot && bcache.nhot < bcache.nbuf - bcache.nbuf/4){
+        b->hot = 1;
+        bcache.nhot++;
+      }
+      continue;
+    }
+    if(b->hot){
+      b->hot = 0;
+      bcache.nhot--;
+      continue;
+    }
+    // A lookup may have taken it since we looked.
+    bk = bucketof(b->dev, b->blockno);
+    acquire(&bk->lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      *bkp = bk;
+      return b;
+    }
+    release(&bk->lock);
+  }
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
+// If not found, allocate a buffer, waiting for one
+// to be released if all are in use.
 // In either case, return locked buffer.
 static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk, *vbk;
+  int waiting;
 
-  acquire(&bcache.lock);
+  bk = bucketof(dev, blockno);
+  acquire(&bk->lock);
+  b = bucketfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    acquiresleep(&b->lock);
+    return b;
+  }
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached. Only one CPU at a time recycles buffers, so look
+  // again in case another one just brought the block in.
+  acquire(&bcache.lock);
+  waiting = 0;
+  for(;;){
+    acquire(&bk->lock);
+    b = bucketfind(bk, dev, blockno);
+    release(&bk->lock);
+    if(b)
+      break;
+    if((b = bvictim(&vbk)) != 0)
+      break;
+    if(!waiting){
+      // Every buffer is in use. Tell brelse we are waiting, then
+      // look once more so that no release can slip by unnoticed.
+      waiting = 1;
+      bcache.nwait++;
+      __sync_synchronize();
+      continue;
     }
+    sleep(&bcache, &bcache.lock);
   }
+  if(waiting)
+    bcache.nwait--;
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  if(b->dev != dev || b->blockno != blockno){
+    // Recycle victim b, whose bucket vbk is locked.
+    bucketremove(vbk, b);
+    b->dev = dev;
+    b->blockno = blockno;
+    b->flags = 0;
+    b->refcnt = 1;
+    b->used = 0;
+    b->ahead = 0;
+    if(vbk != bk){
+      release(&vbk->lock);
+      acquire(&bk->lock);
     }
+    bucketinsert(bk, b);
+    release(&bk->lock);
   }
-  panic("bget: no buffers");
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -115,8 +291,55 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Start reading a block into the cache without waiting for it,
+// unless it is cached already.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  bk = bucketof(dev, blockno);
+  acquire(&bk->lock);
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  release(&bk->lock);
+  if(b)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  b->ahead = 1;
+  bsubmit(b, bdone);
+}
+
+// Drop a reference to b, which is unlocked.
+// Wake up bget callers waiting for a free buffer.
+static void
+bunref(struct buf *b)
+{
+  struct bucket *bk;
+  int freed;
+
+  // b can't be rehashed while we hold a reference.
+  bk = bucketof(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  freed = b->refcnt == 0;
+  release(&bk->lock);
+
+  if(freed && bcache.nwait > 0){
+    acquire(&bcache.lock);
+    wakeup(&bcache);
+    release(&bcache.lock);
+  }
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
@@ -124,20 +347,72 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bunref(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+// Start I/O on the locked buffer b without waiting for it:
+// a write if B_DIRTY is set, otherwise a read.
+// When the request completes the disk driver calls done(b),
+// possibly from an interrupt, so done must not sleep.
+// b stays locked until then and done takes over the caller's
+// hold on it; e.g. bdone just releases it.
+void
+bsubmit(struct buf *b, void (*done)(struct buf*))
+{
+  if(!holdingsleep(&b->lock))
+    panic("bsubmit");
+  b->done = done;
+  b->flags |= B_ASYNC;
+  iderw(b);
+}
+
+// Completion for bsubmit: release b on behalf of the
+// process that submitted it.
+void
+bdone(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bunref(b);
+}
+
+void
+initbwait(struct bwait *w)
+{
+  initlock(&w->lock, "bwait");
+  w->pending = 0;
+}
+
+static void
+bwaitdone(struct buf *b)
+{
+  struct bwait *w = b->donearg;
+
+  acquire(&w->lock);
+  if(--w->pending == 0)
+    wakeup(w);
+  release(&w->lock);
+}
+
+// Submit b as part of the batch w (see bsubmit).
+// b stays locked by the caller, who can use it again after bwait.
+void
+bsubmitwait(struct bwait *w, struct buf *b)
+{
+  acquire(&w->lock);
+  w->pending++;
+  release(&w->lock);
+  b->donearg = w;
+  bsubmit(b, bwaitdone);
+}
+
+// Wait for all requests submitted to w to complete.
+void
+bwait(struct bwait *w)
+{
+  acquire(&w->lock);
+  while(w->pending > 0)
+    sleep(w, &w->lock);
+  release(&w->lock);
 }
 //PAGEBREAK!
 // Blank page.
@@ -4,11 +4,26 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uchar hot;        // referenced again since it was brought in (see bget)
+  uchar used;       // CLOCK reference bit
+  uchar ahead;      // read ahead and not looked up since
+  struct buf *prev; // hash bucket list
   struct buf *next;
+  struct buf *clocknext; // ring of all buffers
   struct buf *qnext; // disk queue
+  uint deadline;    // tick by which the disk scheduler should start it
+  uchar prio;       // submitter's RSDL default level, for IOPRIO
+  void (*done)(struct buf*); // called when B_ASYNC I/O completes (see bsubmit)
+  void *donearg;    // for use by done
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // no one waits for the I/O; the disk driver calls b->done
+
+// A batch of asynchronous requests that can be waited for together.
+struct bwait {
+  struct spinlock lock;
+  int pending;      // requests submitted but not yet done
+};
 
@@ -1,21 +1,34 @@
 #include "param.h"
 struct buf;
+struct bwait;
 struct context;
 struct file;
 struct inode;
+struct lockstat;
 struct pipe;
 struct proc;
+struct rwlock;
+struct seqlock;
+struct slabcache;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct memstat;
+struct vmstat;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            breadahead(uint, uint);
+void            bsubmit(struct buf*, void(*)(struct buf*));
+void            bdone(struct buf*);
+void            initbwait(struct bwait*);
+void            bsubmitwait(struct bwait*, struct buf*);
+void            bwait(struct bwait*);
 
 // console.c
 void            consoleinit(void);
@@ -25,6 +38,7 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -66,7 +80,13 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kallocuser(void);
 void            kfree(char*);
+char*           kallocpages(int);
+void            kfreepages(char*, int);
+uint            kfreecount(void);
+void            kincref(char*);
+int             krefcount(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -87,6 +107,7 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            log_sync(void);
 
 // mp.c
 extern int      ismp;
@@ -97,6 +118,7 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -108,8 +130,12 @@ int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             priofork(int);
+int             spawn(char*, char**, int);
+int             memstat(struct memstat*, int);
+int             rsslimit(int);
 int             growproc(int);
 int             kill(int);
+void            kproc(char*, void(*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -132,10 +158,31 @@ void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+int             lockstat(struct lockstat*, int);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// rwlock.c
+void            acquireread(struct rwlock*);
+void            acquirewrite(struct rwlock*);
+int             holdingwrite(struct rwlock*);
+void            initrwlock(struct rwlock*, char*);
+void            releaseread(struct rwlock*);
+void            releasewrite(struct rwlock*);
+
+// seqlock.c
+void            initseqlock(struct seqlock*);
+uint            readseqbegin(struct seqlock*);
+int             readseqretry(struct seqlock*, uint);
+void            writeseqbegin(struct seqlock*);
+void            writeseqend(struct seqlock*);
+
+// slab.c
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+void            slabinit(struct slabcache*, char*, uint, void(*)(void*));
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -181,12 +228,15 @@ void            seginit(void);
 void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
-int             allocuvm(pde_t*, uint, uint);
-int             deallocuvm(pde_t*, uint, uint);
+int             allocuvm(pde_t*, uint, uint, struct vmstat*);
+int             deallocuvm(pde_t*, uint, uint, struct vmstat*);
 void            freevm(pde_t*);
-void            inituvm(pde_t*, char*, uint);
+void            inituvm(pde_t*, char*, uint, struct vmstat*);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*, uint, struct vmstat*);
+int             cowcopy(pde_t*, uint);
+int             demandpage(struct proc*, uint);
+int             faultin(struct proc*, uint, uint, int);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
@@ -7,17 +7,21 @@
 #include "x86.h"
 #include "elf.h"
 
+// Replace the user image of p with the program at path.
+// p is either the calling process (exec) or a new process
+// that has no user memory yet (spawn).
 int
-exec(char *path, char **argv)
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe, *oldexe;
   struct proghdr ph;
+  struct vmseg seg[NVMSEG];
+  struct vmstat vm;
   pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
 
   begin_op();
 
@@ -28,6 +32,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  exe = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -37,9 +42,16 @@ exec(char *path, char **argv)
 
   if((pgdir = setupkvm()) == 0)
     goto bad;
+  vm.rss = 0;
+  vm.ptpages = 1;
+  vm.rsslimit = p->vm.rsslimit;
 
   // Load program into memory.
+  // Segments are only recorded here and paged in from ip on first
+  // touch (see demandpage in vm.c); any beyond NVMSEG are loaded now.
   sz = 0;
+  nseg = 0;
+  memset(seg, 0, sizeof(seg));
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -49,21 +61,34 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
+    if(nseg < NVMSEG){
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].off = ph.off;
+      seg[nseg].filesz = ph.filesz;
+      nseg++;
+      continue;
+    }
+    if(allocuvm(pgdir, ph.vaddr, ph.vaddr + ph.memsz, &vm) == 0)
+      goto bad;
     if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  // Keep a reference to the executable for demand paging.
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
   // Allocate two pages at the next page boundary.
   // Make the first inaccessible.  Use the second as the user stack.
   sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
+  if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE, &vm)) == 0)
     goto bad;
   clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
   sp = sz;
@@ -91,16 +116,27 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  oldpgdir = p->pgdir;
+  oldexe = p->exe;
+  p->pgdir = pgdir;
+  p->vm = vm;
+  p->exe = exe;
+  memmove(p->seg, seg, sizeof(seg));
+  p->sz = sz;
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
+  if(p == myproc())
+    switchuvm(p);
+  if(oldpgdir)
+    freevm(oldpgdir);
+  if(oldexe){
+    begin_op();
+    iput(oldexe);
+    end_op();
+  }
   return 0;
 
  bad:
@@ -110,5 +146,16 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
+
+int
+exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
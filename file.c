@@ -8,18 +8,20 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "slab.h"
 #include "file.h"
 
 struct devsw devsw[NDEV];
 struct {
-  struct spinlock lock;
-  struct file file[NFILE];
+  struct spinlock lock;     // protects ref of all files
+  struct slabcache cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  slabinit(&ftable.cache, "file", sizeof(struct file), 0);
 }
 
 // Allocate a file structure.
@@ -28,16 +30,12 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = slaballoc(&ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->type = FD_NONE;
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,6 +67,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  slabfree(&ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -146,11 +145,11 @@ filewrite(struct file *f, char *addr, int n)
 
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
       i += r;
+      if(r != n1)
+        break;  // file cannot grow further
     }
-    return i == n ? n : -1;
+    return i > 0 || n == 0 ? i : -1;
   }
   panic("filewrite");
 }
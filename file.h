@@ -16,13 +16,18 @@ struct inode {
   int ref;            // Reference count
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint rnext;         // offset after the last byte read, to detect sequential reads
+  uint rahead;        // blocks before this have been read ahead
+  struct extent hint; // extent bmap found last
+  uint hintbn;        // file block of hint.start
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  struct extent ext[NEXTENT];
+  uint indirect;
 };
 
 // table mapping major device number to
@@ -1,11 +1,12 @@
 // Test that fork fails gracefully.
 // Tiny executable so that the limit can be filling the proc table.
 
+#include "param.h"
 #include "types.h"
 #include "stat.h"
 #include "user.h"
 
-#define N  1000
+#define N  MAXPROC
 
 void
 printf(int fd, const char *s, ...)
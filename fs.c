@@ -23,6 +23,7 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void itrim(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -52,46 +53,71 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate the first free block in [from, to), together with
+// the free blocks right behind it in the same bitmap block,
+// up to max blocks in all.  Sets *n to the number allocated.
+// Returns 0 if there is no free block in the range.
 static uint
-balloc(uint dev)
+ballocfrom(uint dev, uint from, uint to, uint max, uint *n)
 {
-  int b, bi, m;
+  uint b, bi, first;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  for(b = from - from%BPB; b < to; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
+    for(bi = (b < from ? from - b : 0); bi < BPB && b + bi < to; bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0){  // Is block free?
+        first = b + bi;
+        for(*n = 0; *n < max && bi < BPB && b + bi < sb.size &&
+            (bp->data[bi/8] & (1 << (bi % 8))) == 0; (*n)++, bi++)
+          bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        return first;
       }
     }
     brelse(bp);
   }
-  panic("balloc: out of blocks");
+  return 0;
 }
 
-// Free a disk block.
+// Allocate up to max consecutive disk blocks, starting at the first
+// free block at or after goal.  Sets *n to the number allocated.
+// The blocks are not zeroed.
+static uint
+ballocrun(uint dev, uint goal, uint max, uint *n)
+{
+  uint b;
+
+  if(goal >= sb.size)
+    goal = 0;
+  if((b = ballocfrom(dev, goal, sb.size, max, n)) == 0 &&
+     (b = ballocfrom(dev, 0, goal, max, n)) == 0)
+    panic("balloc: out of blocks");
+  return b;
+}
+
+// Free n disk blocks starting at b.
 static void
-bfree(int dev, uint b)
+bfree(int dev, uint b, uint n)
 {
   struct buf *bp;
   int bi, m;
 
-  bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
-  m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
-  brelse(bp);
+  while(n > 0){
+    bp = bread(dev, BBLOCK(b, sb));
+    do {
+      bi = b % BPB;
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bp->data[bi/8] &= ~m;
+      b++;
+      n--;
+    } while(n > 0 && b % BPB != 0);
+    log_write(bp);
+    brelse(bp);
+  }
 }
 
 // Inodes.
@@ -230,7 +256,8 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
+  dip->indirect = ip->indirect;
   log_write(bp);
   brelse(bp);
 }
@@ -266,6 +293,9 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->rnext = 0;
+  ip->rahead = 0;
+  ip->hint.len = 0;
   release(&icache.lock);
 
   return ip;
@@ -303,7 +333,8 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->ext, dip->ext, sizeof(ip->ext));
+    ip->indirect = dip->indirect;
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -325,7 +356,8 @@ iunlock(struct inode *ip)
 // If that was the last reference, the inode cache entry can
 // be recycled.
 // If that was the last reference and the inode has no links
-// to it, free the inode (and its content) on disk.
+// to it, free the inode (and its content) on disk; else free
+// the blocks allocated past its end.
 // All calls to iput() must be inside a transaction in
 // case it has to free the inode.
 void
@@ -343,6 +375,14 @@ iput(struct inode *ip)
       iupdate(ip);
       ip->valid = 0;
     }
+  } else if(ip->valid){
+    acquire(&icache.lock);
+    int r = ip->ref;
+    release(&icache.lock);
+    if(r == 1){
+      // last reference: give back the blocks allocated past the end.
+      itrim(ip);
+    }
   }
   releasesleep(&ip->lock);
 
@@ -363,40 +403,107 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// in runs of consecutive blocks on the disk, called extents.
+// The first NEXTENT extents are listed in ip->ext[].  The next
+// NINDEXTENT are listed in block ip->indirect.  Extents are
+// used in order; the first with len 0 ends the list.
+//
+// A file grows only at its end (see writei), so bmap allocates
+// NEXTALLOC blocks at a time, extending the last extent when the
+// blocks behind it are free.  Blocks allocated past the end of
+// the file are not zeroed: readi never returns bytes past
+// ip->size, and writei writes every byte before it.  itrim frees
+// the blocks past the end when the last reference goes away.
+// They are committed as part of the file until then, so after a
+// crash up to NEXTALLOC-1 blocks per file that was being written
+// stay allocated; they are freed the next time that file is
+// opened and closed, or when it is deleted.
+
+// Return the ith extent of ip.  *bp holds the indirect
+// extent block once it is needed.
+static struct extent*
+extent(struct inode *ip, uint i, struct buf **bp)
+{
+  if(i < NEXTENT)
+    return &ip->ext[i];
+  if(*bp == 0)
+    *bp = bread(ip->dev, ip->indirect);
+  return (struct extent*)(*bp)->data + (i - NEXTENT);
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If bn is the block just past the allocated ones, bmap allocates
+// it.  Returns 0 if the file has run out of extents.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  struct extent *e, *last;
   struct buf *bp;
+  uint i, fbn, b, n;
+  int ind;
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
-    return addr;
-  }
-  bn -= NDIRECT;
+  // Sequential access stays within one extent.
+  if(bn >= ip->hintbn && bn < ip->hintbn + ip->hint.len)
+    return ip->hint.start + bn - ip->hintbn;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+  bp = 0;
+  last = 0;
+  fbn = 0;
+  for(i = 0; i < NEXTENT + NINDEXTENT; i++){
+    if(i == NEXTENT && ip->indirect == 0)
+      break;
+    e = extent(ip, i, &bp);
+    if(e->len == 0)
+      break;
+    if(bn < fbn + e->len){
+      b = e->start + bn - fbn;
+      goto found;
     }
-    brelse(bp);
-    return addr;
+    fbn += e->len;
+    last = e;
+  }
+  if(bn != fbn)
+    panic("bmap: hole");
+
+  // Grow the last extent if the blocks behind it are free,
+  // else start a new one.
+  b = ballocrun(ip->dev, last ? last->start + last->len : 0, NEXTALLOC, &n);
+  if(last != 0 && b == last->start + last->len){
+    e = last;
+    ind = i > NEXTENT;
+    fbn -= e->len;
+    e->len += n;
+  } else if(i < NEXTENT + NINDEXTENT){
+    ind = i >= NEXTENT;
+    if(i == NEXTENT && ip->indirect == 0){
+      // Put the indirect block in front of the new run,
+      // not behind it where the run will want to grow.
+      ip->indirect = b;
+      bzero(ip->dev, b);
+      if(--n > 0)
+        b++;
+      else
+        b = ballocrun(ip->dev, b + 1, NEXTALLOC, &n);
+    }
+    e = extent(ip, i, &bp);
+    e->start = b;
+    e->len = n;
+  } else {
+    bfree(ip->dev, b, n);
+    if(bp)
+      brelse(bp);
+    return 0;
   }
+  if(ind)
+    log_write(bp);
+  b = e->start + bn - fbn;
 
-  panic("bmap: out of range");
+found:
+  ip->hint = *e;
+  ip->hintbn = fbn;
+  if(bp)
+    brelse(bp);
+  return b;
 }
 
 // Truncate inode (discard contents).
@@ -407,33 +514,81 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
+  int i;
   struct buf *bp;
-  uint *a;
+  struct extent *e;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  bp = 0;
+  for(i = 0; i < NEXTENT + NINDEXTENT; i++){
+    if(i == NEXTENT && ip->indirect == 0)
+      break;
+    e = extent(ip, i, &bp);
+    if(e->len == 0)
+      break;
+    bfree(ip->dev, e->start, e->len);
+    if(i < NEXTENT)
+      e->len = 0;
   }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
+  if(bp){
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, ip->indirect, 1);
+    ip->indirect = 0;
   }
 
+  ip->hint.len = 0;
   ip->size = 0;
   iupdate(ip);
 }
 
+// Free the blocks past the end of the file that bmap
+// allocated ahead of time (see NEXTALLOC).
+// Called when the last reference to ip goes away.
+static void
+itrim(struct inode *ip)
+{
+  int i, changed, ind;
+  uint fbn, nb, n;
+  struct buf *bp;
+  struct extent *e;
+
+  nb = (ip->size + BSIZE - 1) / BSIZE;
+  bp = 0;
+  changed = ind = 0;
+  fbn = 0;
+  for(i = 0; i < NEXTENT + NINDEXTENT; i++){
+    if(i == NEXTENT && ip->indirect == 0)
+      break;
+    e = extent(ip, i, &bp);
+    if(e->len == 0)
+      break;
+    if(fbn + e->len > nb){
+      n = fbn >= nb ? e->len : fbn + e->len - nb;
+      bfree(ip->dev, e->start + e->len - n, n);
+      e->len -= n;
+      changed = 1;
+      if(i >= NEXTENT)
+        ind = 1;
+    }
+    fbn += e->len;
+  }
+  if(bp){
+    if(extent(ip, NEXTENT, &bp)->len == 0){
+      brelse(bp);
+      bfree(ip->dev, ip->indirect, 1);
+      ip->indirect = 0;
+    } else {
+      if(ind)
+        log_write(bp);
+      brelse(bp);
+    }
+  }
+
+  if(changed){
+    ip->hint.len = 0;
+    iupdate(ip);
+  }
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -446,6 +601,29 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Start reading blocks first..last of ip into the buffer cache,
+// skipping those already read ahead and any past the end of the file.
+// The window (ip->rnext, ip->rahead) belongs to the inode, not to an
+// open file, so readers sharing an inode share it: two processes
+// reading the same file at different offsets look random to each
+// other and get no read-ahead, though their reads still work.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint first, uint last)
+{
+  uint bn, nblocks;
+
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  if(last >= nblocks)
+    last = nblocks - 1;
+  if(first < ip->rahead)
+    first = ip->rahead;
+  for(bn = first; bn <= last && bn < nblocks; bn++)
+    breadahead(ip->dev, bmap(ip, bn));
+  if(bn > ip->rahead)
+    ip->rahead = bn;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
@@ -453,6 +631,7 @@ int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
+  int seq;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -466,12 +645,20 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  seq = off == ip->rnext || off == 0;
+  if(!seq)
+    ip->rahead = 0;
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    // Queue the rest of this read and the next blocks behind it.
+    if(tot == 0 && seq && n > 0)
+      readahead(ip, off/BSIZE + 1, (off + n - 1)/BSIZE + NREADAHEAD);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
   }
+  if(n > 0)
+    ip->rnext = off;
   return n;
 }
 
@@ -481,7 +668,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -496,18 +683,20 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    if((addr = bmap(ip, off/BSIZE)) == 0)
+      break;  // out of extents
+    bp = bread(ip->dev, addr);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
     log_write(bp);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
+  if(tot > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return n > 0 && tot == 0 ? -1 : tot;
 }
 
 //PAGEBREAK!
@@ -21,9 +21,15 @@ struct superblock {
   uint bmapstart;    // Block number of first free map block
 };
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+// A run of consecutive data blocks of a file.
+struct extent {
+  uint start;           // First block
+  uint len;             // Number of blocks; 0 if unused
+};
+
+#define NEXTENT 6
+#define NINDEXTENT (BSIZE / sizeof(struct extent))
+#define MAXFILE 1024    // max blocks in a file
 
 // On-disk inode structure
 struct dinode {
@@ -32,7 +38,8 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  struct extent ext[NEXTENT]; // Data blocks, in file order
+  uint indirect;        // Block of NINDEXTENT more extents
 };
 
 // Inodes per block.
@@ -1,4 +1,7 @@
 // Simple PIO-based (non-DMA) IDE driver code.
+// Waiting requests are ordered by the disk scheduler (IOSCHED),
+// and requests for consecutive blocks are merged into one
+// READ/WRITE MULTIPLE command.
 
 #include "types.h"
 #include "defs.h"
@@ -23,16 +26,30 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+#define IDE_MAXSECT   16  // max sectors per command (READ/WRITE MULTIPLE block)
 
-static struct spinlock idelock;
+// Disk schedulers, chosen by IOSCHED in param.h.
+#define IOSCHED_FIFO      0  // in order of submission
+#define IOSCHED_DEADLINE  1  // C-LOOK by block number, but expired requests first
+
+// idequeue points to the idecount bufs now being read/written to
+// the disk, chained through qnext.
+// iopending holds the bufs waiting for the disk, chained through
+// qnext: in submission order for IOSCHED_FIFO, sorted by dev and
+// blockno for IOSCHED_DEADLINE.
+// iodev and iopos are where the last request left the disk head.
+// You must hold idelock while manipulating the queues.
+
+static struct spinlock idelock __attribute__((aligned(CACHELINE)));
 static struct buf *idequeue;
+static int idecount;
+static struct buf *iopending;
+static uint iodev, iopos;
 
 static int havedisk1;
-static void idestart(struct buf*);
+static void idestart(void);
 
 // Wait for IDE disk to become ready.
 static int
@@ -65,35 +82,137 @@ ideinit(void)
     }
   }
 
+  // Transfer up to IDE_MAXSECT sectors per interrupt
+  // with READ/WRITE MULTIPLE.
+  for(i = 0; i <= havedisk1; i++){
+    idewait(0);
+    outb(0x1f2, IDE_MAXSECT);
+    outb(0x1f6, 0xe0 | (i<<4));
+    outb(0x1f7, IDE_CMD_SETMUL);
+  }
+  idewait(0);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Add b to iopending.  Caller must hold idelock.
+static void
+ioinsert(struct buf *b)
+{
+  struct buf **pp;
+  struct proc *p;
+
+  // ticks is read without tickslock; being a tick off is harmless.
+  b->deadline = ticks + ((b->flags & B_DIRTY) ? IOWRITEEXPIRE : IOREADEXPIRE);
+  b->prio = (p = myproc()) ? p->default_level : RSDL_LEVELS;
+
+  pp = &iopending;
+#if IOSCHED == IOSCHED_DEADLINE
+  while(*pp && ((*pp)->dev < b->dev ||
+               ((*pp)->dev == b->dev && (*pp)->blockno < b->blockno)))
+    pp = &(*pp)->qnext;
+#else
+  while(*pp)  //DOC:insert-queue
+    pp = &(*pp)->qnext;
+#endif
+  b->qnext = *pp;
+  *pp = b;
+}
+
+// Choose the next request to start.  Returns the link in
+// iopending that points to it.  Caller must hold idelock.
+static struct buf**
+iopick(void)
+{
+#if IOSCHED == IOSCHED_DEADLINE
+  struct buf **pp, **old, **next, **first;
+  int prio;
+
+  // A request past its deadline goes first, oldest first,
+  // so that neither reads nor writes far from the head starve.
+  old = 0;
+  prio = RSDL_LEVELS;
+  for(pp = &iopending; *pp; pp = &(*pp)->qnext){
+    if(old == 0 || (int)((*pp)->deadline - (*old)->deadline) < 0)
+      old = pp;
+    if(IOPRIO && (*pp)->prio < prio)
+      prio = (*pp)->prio;
+  }
+  if(old != 0 && (int)((*old)->deadline - ticks) <= 0)
+    return old;
+
+  // Otherwise C-LOOK: the first request at or beyond the head,
+  // or, when there is none, the lowest one.  With IOPRIO only
+  // requests from the highest-priority submitters are considered.
+  first = next = 0;
+  for(pp = &iopending; *pp; pp = &(*pp)->qnext){
+    if(IOPRIO && (*pp)->prio != prio)
+      continue;
+    if(first == 0)
+      first = pp;
+    if((*pp)->dev > iodev || ((*pp)->dev == iodev && (*pp)->blockno >= iopos)){
+      next = pp;
+      break;
+    }
+  }
+  return next ? next : first;
+#else
+  return &iopending;
+#endif
+}
+
+// Start the next request, merged with the bufs queued right
+// behind it as long as they continue it on disk.
+// Caller must hold idelock.
 static void
-idestart(struct buf *b)
+idestart(void)
 {
-  if(b == 0)
+  struct buf **pp, *b, *q;
+  int n;
+
+  if(idequeue != 0)
     panic("idestart");
+  if(iopending == 0)
+    return;
+  pp = iopick();
+  b = *pp;
   if(b->blockno >= FSSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  if (sector_per_block > IDE_MAXSECT) panic("idestart");
+
+  // Same disk, same direction, next block.
+  n = 1;
+  for(q = b; q->qnext != 0 && (n+1)*sector_per_block <= IDE_MAXSECT; q = q->qnext, n++){
+    if(q->qnext->dev != b->dev || q->qnext->blockno != q->blockno + 1 ||
+       (q->qnext->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+  }
+  *pp = q->qnext;
+  q->qnext = 0;
+  idequeue = b;
+  idecount = n;
+  iodev = b->dev;
+  iopos = q->blockno + 1;
+
+  int nsect = n * sector_per_block;
+  int read_cmd = (nsect == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsect == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
   if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(q = b; n-- > 0; q = q->qnext)
+      outsl(0x1f0, q->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -103,42 +222,61 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *done, **tail;
+  int i, ok;
 
-  // First queued buffer is the active request.
+  // First idecount queued buffers are the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if(idequeue == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  ok = (idequeue->flags & B_DIRTY) || idewait(1) >= 0;
+  done = 0;
+  tail = &done;
+  for(i = 0; i < idecount; i++){
+    b = idequeue;
+    idequeue = b->qnext;
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Read data if needed.
+    if(!(b->flags & B_DIRTY) && ok)
+      insl(0x1f0, b->data, BSIZE/4);
 
-  // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+    // Wake process waiting for this buf.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      b->qnext = 0;
+      *tail = b;
+      tail = &b->qnext;
+    } else
+      wakeup(b);
+  }
+
+  // Start disk on next request.
+  idestart();
 
   release(&idelock);
+
+  // No one is waiting for these; let the submitters' callbacks finish up.
+  while((b = done) != 0){
+    done = b->qnext;
+    b->done(b);
+  }
 }
 
 //PAGEBREAK!
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, return at once; b->done(b) is called
+// when the request is done (see bsubmit).
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -148,15 +286,16 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  ioinsert(b);
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idequeue == 0)
+    idestart();
+
+  if(b->flags & B_ASYNC){
+    release(&idelock);
+    return;
+  }
 
   // Wait for request to finish.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
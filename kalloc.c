@@ -1,6 +1,12 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, or physically
+// contiguous blocks of 2^order pages (kallocpages).
+//
+// Free memory is kept by a buddy allocator: one free list per
+// order, a block of order k at pa has its buddy at pa ^ (PGSIZE<<k),
+// and freed blocks merge with free buddies into larger blocks.
+// Single pages go through small per-CPU caches in front of it.
 
 #include "types.h"
 #include "defs.h"
@@ -15,14 +21,32 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+#define KFREE 0x80  // in kmem.order: page heads a free block
+
 struct {
-  struct spinlock lock;
+  struct spinlock lock __attribute__((aligned(CACHELINE)));
   int use_lock;
-  struct run *freelist;
+  struct run *freelist[KMAXORDER+1];  // free blocks of each order
+  uint nfree;                         // pages on the free lists
+  uchar order[PHYSTOP/PGSIZE];        // KFREE|order for free block heads
+  // Number of page tables mapping each physical page (indexed by pa/PGSIZE).
+  // Pages are shared copy-on-write after fork; kfree only frees the last one.
+  ushort ref[PHYSTOP/PGSIZE];
 } kmem;
 
+// Per-CPU cache of free pages, so that most kalloc/kfree calls don't
+// touch kmem.lock. Pages move to and from the buddy allocator KBATCH at a time.
+// Only accessed by its own CPU with interrupts off.
+struct kcache {
+  int n;
+  struct run *page[NKCACHE];
+} __attribute__((aligned(CACHELINE)));
+
+static struct kcache kcache[NCPU];
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -49,32 +73,126 @@ freerange(void *vstart, void *vend)
   char *p;
   if (vend < vstart) panic("freerange");
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.ref[V2P(p)/PGSIZE] = 1;
     kfree(p);
+  }
+}
+// Free lists are doubly linked so a buddy can be unlinked
+// when it is merged. Caller holds kmem.lock (or is booting).
+static void
+pushfree(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.order[V2P((char*)r)/PGSIZE] = KFREE | order;
+  kmem.nfree += 1 << order;
+}
+
+static void
+unlinkfree(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.order[V2P((char*)r)/PGSIZE] = 0;
+  kmem.nfree -= 1 << order;
+}
+
+// Take a block of 2^order pages, splitting a larger one if needed.
+static struct run*
+buddyalloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= KMAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  if(k > KMAXORDER)
+    return 0;
+  r = kmem.freelist[k];
+  unlinkfree(r, k);
+  // Give back the upper halves we don't need.
+  while(k > order){
+    k--;
+    pushfree((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  return r;
+}
+
+// Return a block of 2^order pages, merging it with its free buddies.
+static void
+buddyfree(struct run *r, int order)
+{
+  uint pa, buddy;
+
+  pa = V2P((char*)r);
+  while(order < KMAXORDER){
+    buddy = pa ^ (PGSIZE << order);
+    if(buddy >= PHYSTOP || kmem.order[buddy/PGSIZE] != (KFREE | order))
+      break;
+    unlinkfree((struct run*)P2V(buddy), order);
+    if(buddy < pa)
+      pa = buddy;
+    order++;
+  }
+  pushfree((struct run*)P2V(pa), order);
 }
+
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// If the page is shared (see kincref), only drop a reference.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *kc;
+  ushort *ref;
+  int i;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  ref = &kmem.ref[V2P(v)/PGSIZE];
+  if(*ref == 0)
+    panic("kfree: free page");
+  if(__sync_sub_and_fetch(ref, 1) != 0)
+    return;
+
+#if KJUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    // Still booting on one CPU; the caches aren't usable yet.
+    buddyfree(r, 0);
+    return;
+  }
+
+  pushcli();
+  kc = &kcache[cpuid()];
+  if(kc->n == NKCACHE){
+    // Drain the oldest KBATCH pages to the buddy allocator.
+    acquire(&kmem.lock);
+    for(i = 0; i < KBATCH; i++)
+      buddyfree(kc->page[i], 0);
     release(&kmem.lock);
+    memmove(kc->page, kc->page + KBATCH, (NKCACHE - KBATCH) * sizeof(kc->page[0]));
+    kc->n -= KBATCH;
+  }
+  kc->page[kc->n++] = r;
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -82,16 +200,107 @@ kfree(char *v)
 // Returns 0 if the memory cannot be allocated.
 char*
 kalloc(void)
+{
+  struct run *r;
+  struct kcache *kc;
+
+  if(!kmem.use_lock){
+    r = buddyalloc(0);
+  } else {
+    pushcli();
+    kc = &kcache[cpuid()];
+    if(kc->n == 0){
+      // Refill up to KBATCH pages from the buddy allocator.
+      acquire(&kmem.lock);
+      while(kc->n < KBATCH && (r = buddyalloc(0)) != 0)
+        kc->page[kc->n++] = r;
+      release(&kmem.lock);
+    }
+    r = kc->n > 0 ? kc->page[--kc->n] : 0;
+    popcli();
+  }
+  if(r)
+    kmem.ref[V2P((char*)r)/PGSIZE] = 1;
+  return (char*)r;
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Free them with kfreepages(v, order).
+// Returns 0 if no large enough block is free.
+char*
+kallocpages(int order)
 {
   struct run *r;
 
+  if(order < 0 || order > KMAXORDER)
+    panic("kallocpages");
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
+  r = buddyalloc(order);
   if(kmem.use_lock)
     release(&kmem.lock);
+  if(r)
+    kmem.ref[V2P((char*)r)/PGSIZE] = 1;
   return (char*)r;
 }
 
+void
+kfreepages(char *v, int order)
+{
+  ushort *ref;
+
+  if(order < 0 || order > KMAXORDER || V2P(v) % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfreepages");
+  ref = &kmem.ref[V2P(v)/PGSIZE];
+  if(*ref != 1)
+    panic("kfreepages: shared or free");
+  *ref = 0;
+
+#if KJUNK
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  buddyfree((struct run*)v, order);
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Allocate a page of user memory, like kalloc(), unless that would
+// leave fewer than KRESERVE free pages. What every process may use is
+// bounded by its rsslimit; the reserve bounds what they use together,
+// so that the kernel still gets page tables, stacks and buffers.
+char*
+kallocuser(void)
+{
+  if(kmem.nfree < KRESERVE)
+    return 0;
+  return kalloc();
+}
+
+// Number of free pages, not counting those in per-CPU caches.
+uint
+kfreecount(void)
+{
+  return kmem.nfree;
+}
+
+// Add a reference to the allocated page v, which must then be
+// kfree'd once more before it is actually freed.
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kincref");
+  __sync_fetch_and_add(&kmem.ref[V2P(v)/PGSIZE], 1);
+}
+
+// Number of references to the allocated page v.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
+
@@ -0,0 +1,53 @@
+// Print spinlock contention statistics collected by the kernel.
+// usage: lockstat [name]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "lockstat.h"
+
+struct lockstat st[NLOCKSTAT];
+
+// printf has no 64-bit conversion
+void
+printull(uint64 x)
+{
+  char buf[21];
+  int i = sizeof(buf) - 1;
+
+  buf[i] = 0;
+  do {
+    buf[--i] = '0' + x % 10;
+    x /= 10;
+  } while(x != 0);
+  printf(1, "%s", &buf[i]);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, n;
+
+  if((n = lockstat(st, NLOCKSTAT)) < 0){
+    printf(2, "lockstat: kernel built without LOCKSTAT\n");
+    exit();
+  }
+
+  printf(1, "name acquire contended spin-cycles max-hold-cycles [pc:contended...]\n");
+  for(i = 0; i < n; i++){
+    if(argc > 1 && strcmp(argv[1], st[i].name) != 0)
+      continue;
+    if(st[i].nacquire == 0)
+      continue;
+    printf(1, "%s %d %d ", st[i].name, st[i].nacquire, st[i].ncontended);
+    printull(st[i].spin);
+    printf(1, " ");
+    printull(st[i].maxhold);
+    for(j = 0; j < NLOCKSITE; j++){
+      if(st[i].sitecnt[j] != 0)
+        printf(1, " %x:%d", st[i].sitepc[j], st[i].sitecnt[j]);
+    }
+    printf(1, "\n");
+  }
+  exit();
+}
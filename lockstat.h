@@ -0,0 +1,15 @@
+#define NLOCKSITE   4  // hottest call sites kept per lock name
+
+// Contention statistics, shared by all spinlocks with the same name.
+// Locks sharing a name (e.g. every "level queue") update it from
+// several cpus; a site sample is dropped when another cpu is updating
+// the site table, so site counts are approximate.
+struct lockstat {
+  char name[16];             // Lock name
+  uint nacquire;             // Number of acquisitions
+  uint ncontended;           // Acquisitions that had to spin
+  uint64 spin;               // Cycles spent spinning (rdtsc)
+  uint64 maxhold;            // Longest time the lock was held (cycles)
+  uint sitepc[NLOCKSITE];    // Callers of acquire() that spun the most often
+  uint sitecnt[NLOCKSITE];   // Contended acquisitions from sitepc[i]
+};
@@ -9,25 +9,43 @@
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
-// write an uncommitted system call's updates to disk.
+// calls. Transactions are double-buffered: the running one
+// collects system calls while the previous one is written to
+// the disk by logd. The running transaction is closed when it
+// may run out of log space or has been open for LOGDELAY ticks;
+// once its outstanding calls have ended, logd copies its blocks
+// aside and opens the next transaction before doing any disk I/O.
+// So there is never any reasoning required about whether a commit
+// might write an uncommitted system call's updates to disk, and
+// system calls only wait for the short copy, or for a commit if
+// the running transaction fills up before it is done.
+//
+// Committed blocks are not written to their home locations right
+// away. They stay in the log, and pinned in the buffer cache,
+// until logd checkpoints the log: when it has been idle for
+// LOGCKPT ticks, or the log is more than half full or too full
+// for the next commit. A block committed again in the meantime
+// replaces its older copy, so it is installed only once.
 //
 // A system call should call begin_op()/end_op() to mark
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// But if the running transaction is closed, or it thinks the
+// log is close to running out, it sleeps until the next
+// transaction opens. end_op() returns before the commit;
+// log_sync() waits for everything logged so far to commit.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
+//   header block, containing block #s for slots A, B, C, ...
+//   slot A
+//   slot B
+//   slot C
 //   ...
-// Log appends are synchronous.
+// A slot with block # 0 is free. A commit writes its blocks
+// to slots that are free in the current header, then writes
+// the new header, in which the slots of blocks it committed
+// again are free.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -41,18 +59,32 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int closing;     // running transaction takes no new sys calls.
+  int committing;  // logd is writing the committed transaction.
+  int used;        // slots holding committed blocks.
+  uint opened;     // ticks when the running transaction logged its first block
+  uint committed;  // ticks when the oldest uninstalled block was committed
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // running transaction
+  struct logheader clh; // on-disk header: committed, uninstalled blocks
+  struct logheader nlh; // next on-disk header, during commit
 };
 struct log log;
 
+// Copies of the committed blocks, by slot, written to the
+// log and then to their home locations. They are not in the
+// buffer cache, so the cache is free to hold newer contents.
+// Only logd (and recovery) uses them.
+static struct buf logbuf[LOGSIZE];
+
 static void recover_from_log(void);
-static void commit();
+static void logd(void);
 
 void
 initlog(int dev)
 {
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
@@ -62,23 +94,34 @@ initlog(int dev)
   log.start = sb.logstart;
   log.size = sb.nlog;
   log.dev = dev;
+  for (i = 0; i < LOGSIZE; i++) {
+    initsleeplock(&logbuf[i].lock, "logbuf");
+    logbuf[i].dev = dev;
+  }
   recover_from_log();
+  kproc("logd", logd);
 }
 
-// Copy committed blocks from log to their home location
+// Write the committed blocks in logbuf to their home locations
 static void
 install_trans(void)
 {
   int tail;
+  struct bwait w;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  initbwait(&w);
+  for (tail = 0; tail < log.clh.n; tail++) {
+    if (log.clh.block[tail] == 0)
+      continue;
+    acquiresleep(&logbuf[tail].lock);
+    logbuf[tail].blockno = log.clh.block[tail];
+    logbuf[tail].flags = B_VALID | B_DIRTY;
+    bsubmitwait(&w, &logbuf[tail]);  // write dst to disk
   }
+  bwait(&w);
+  for (tail = 0; tail < log.clh.n; tail++)
+    if (log.clh.block[tail] != 0)
+      releasesleep(&logbuf[tail].lock);
 }
 
 // Read the log header from disk into the in-memory log header
@@ -88,37 +131,55 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.n = lh->n;
+  for (i = 0; i < log.clh.n; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write in-memory log header h to disk.
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *h)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = h->n;
+  for (i = 0; i < h->n; i++) {
+    hb->block[i] = h->block[i];
   }
   bwrite(buf);
   brelse(buf);
 }
 
+// Nothing else uses the disk yet, so the log slots are read
+// straight into logbuf, bypassing the cache.
 static void
 recover_from_log(void)
 {
+  int tail;
+  struct bwait w;
+
   read_head();
+  initbwait(&w);
+  for (tail = 0; tail < log.clh.n; tail++) {
+    if (log.clh.block[tail] == 0)
+      continue;
+    acquiresleep(&logbuf[tail].lock);
+    logbuf[tail].blockno = log.start+tail+1;
+    logbuf[tail].flags = 0;
+    bsubmitwait(&w, &logbuf[tail]);  // read log block
+  }
+  bwait(&w);
+  for (tail = 0; tail < log.clh.n; tail++)
+    if (log.clh.block[tail] != 0)
+      releasesleep(&logbuf[tail].lock);
   install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  log.clh.n = 0;
+  write_head(&log.clh); // clear the log
 }
 
 // called at the start of each FS system call.
@@ -127,10 +188,12 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.closing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.size - 1){
+      // this op might exhaust log space; commit and wait for the next transaction.
+      log.closing = 1;
+      wakeup(&log);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -141,63 +204,185 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// the transaction is committed later, by logd.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
+  // begin_op() may be waiting for log space, and decrementing
+  // log.outstanding has decreased the amount of reserved space;
+  // or this was the last op of a closed transaction, and logd
+  // is waiting to commit it.
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Wait until every FS system call that has ended is on disk.
+void
+log_sync(void)
+{
+  acquire(&log.lock);
+  while(log.lh.n > 0 || log.closing || log.committing){
+    if(log.lh.n > 0)
+      log.closing = 1;
     wakeup(&log);
+    sleep(&log, &log.lock);
   }
   release(&log.lock);
+}
+
+// Is slot filled by the commit in progress?
+static int
+newslot(int slot)
+{
+  return log.nlh.block[slot] != 0 &&
+         (slot >= log.clh.n || log.clh.block[slot] == 0);
+}
+
+// Write the blocks copied by the commit in progress to the log.
+static void
+write_log(void)
+{
+  int tail;
+  struct bwait w;
+
+  initbwait(&w);
+  for (tail = 0; tail < log.nlh.n; tail++) {
+    if (!newslot(tail))
+      continue;
+    acquiresleep(&logbuf[tail].lock);
+    logbuf[tail].blockno = log.start+tail+1;
+    logbuf[tail].flags = B_VALID | B_DIRTY;
+    bsubmitwait(&w, &logbuf[tail]);  // write the log
+  }
+  bwait(&w);
+  for (tail = 0; tail < log.nlh.n; tail++)
+    if (newslot(tail))
+      releasesleep(&logbuf[tail].lock);
+}
+
+// Install the committed blocks and empty the log.
+static void
+checkpoint(void)
+{
+  int tail, running;
+  struct buf *b;
+
+  install_trans();
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
+  // Unpin the cached blocks, unless the running
+  // transaction has logged them again.
+  for (tail = 0; tail < log.clh.n; tail++) {
+    if (log.clh.block[tail] == 0)
+      continue;
+    b = bread(log.dev, log.clh.block[tail]);
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    for (running = 0; running < log.lh.n; running++)
+      if (log.lh.block[running] == b->blockno)
+        break;
+    if (running == log.lh.n)
+      b->flags &= ~B_DIRTY;
     release(&log.lock);
+    brelse(b);
   }
+
+  log.clh.n = 0;
+  write_head(&log.clh);    // Erase the transactions from the log
+  log.used = 0;
 }
 
-// Copy modified blocks from cache to log.
+// Commit the running transaction, which is closed and has
+// no outstanding FS system calls.
 static void
-write_log(void)
+commit(void)
 {
-  int tail;
+  int tail, i, slot, n;
+  struct buf *b;
 
+  // A commit can only use slots that are free on disk.
+  // The header takes the first log block, so there are log.size-1.
+  if (log.size - 1 - log.used < log.lh.n)
+    checkpoint();
+
+  // No sys call can log a block until closing is cleared,
+  // so the cache holds exactly what the transaction wrote.
+  // Copy each block to a free slot, freeing the slot of
+  // its older committed copy, if any.
+  log.nlh = log.clh;
+  slot = 0;
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+    for (i = 0; i < log.nlh.n; i++)
+      if (log.nlh.block[i] == log.lh.block[tail])   // log absorbtion
+        log.nlh.block[i] = 0;
+    while (slot < log.clh.n && log.clh.block[slot] != 0)
+      slot++;
+    if (slot >= log.size - 1)
+      panic("commit: out of log slots");
+    b = bread(log.dev, log.lh.block[tail]); // cache block
+    memmove(logbuf[slot].data, b->data, BSIZE);
+    brelse(b);
+    log.nlh.block[slot] = log.lh.block[tail];
+    if (slot >= log.nlh.n)
+      log.nlh.n = slot+1;
+    slot++;
   }
+  while (log.nlh.n > 0 && log.nlh.block[log.nlh.n-1] == 0)
+    log.nlh.n--;
+
+  // Open the next transaction.
+  acquire(&log.lock);
+  n = log.lh.n;
+  log.lh.n = 0;
+  log.closing = 0;
+  log.committing = 1;
+  wakeup(&log);
+  release(&log.lock);
+
+  if (n > 0) {
+    write_log();           // Write copied blocks to free slots
+    write_head(&log.nlh);  // Write header to disk -- the real commit
+    if (log.used == 0)
+      log.committed = ticks;
+    log.clh = log.nlh;
+    log.used = 0;
+    for (i = 0; i < log.clh.n; i++)
+      if (log.clh.block[i] != 0)
+        log.used++;
+  }
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
+// Kernel process that commits transactions: when they are
+// closed by begin_op() or log_sync(), or LOGDELAY ticks after
+// they log their first block. It checkpoints the log in the
+// background once it is more than half full, or after no
+// transaction has been running for LOGCKPT ticks.
 static void
-commit()
+logd(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  acquire(&log.lock);
+  for(;;){
+    if(log.lh.n > 0 && (int)(ticks - log.opened) >= LOGDELAY)
+      log.closing = 1;
+    if(log.closing && log.outstanding == 0){
+      release(&log.lock);
+      commit();
+      acquire(&log.lock);
+    } else if(log.used > (log.size - 1)/2 ||
+              (log.used > 0 && log.lh.n == 0 && (int)(ticks - log.committed) >= LOGCKPT)){
+      release(&log.lock);
+      checkpoint();
+      acquire(&log.lock);
+    } else if(log.closing || (log.lh.n == 0 && log.used == 0)){
+      sleep(&log, &log.lock);
+    } else {
+      sleep(&ticks, &log.lock);  // let the transaction fill
+    }
   }
 }
 
@@ -226,9 +411,14 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {
+    if (log.lh.n == 0) {
+      // start the commit timer
+      log.opened = ticks;
+      wakeup(&log);
+    }
     log.lh.n++;
+  }
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
-
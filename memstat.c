@@ -0,0 +1,36 @@
+// Print the memory use of every process, or run a command
+// with a lower limit on its resident pages.
+// usage: memstat [-l pages cmd [arg ...]]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "memstat.h"
+
+#define NSTAT 128
+
+struct memstat st[NSTAT];
+
+int
+main(int argc, char *argv[])
+{
+  int i, n;
+
+  if(argc > 1){
+    if(argc < 4 || strcmp(argv[1], "-l") != 0 || atoi(argv[2]) <= 0){
+      printf(2, "usage: memstat [-l pages cmd [arg ...]]\n");
+      exit();
+    }
+    rsslimit(atoi(argv[2]));
+    exec(argv[3], argv + 3);
+    printf(2, "memstat: exec %s failed\n", argv[3]);
+    exit();
+  }
+
+  n = memstat(st, NSTAT);
+  printf(1, "pid name size rss pt-pages rss-limit\n");
+  for(i = 0; i < n; i++)
+    printf(1, "%d %s %d %d %d %d\n", st[i].pid, st[i].name, st[i].sz,
+           st[i].rss, st[i].ptpages, st[i].rsslimit);
+  exit();
+}
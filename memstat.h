@@ -0,0 +1,9 @@
+// Memory use of one process, as reported by the memstat system call.
+struct memstat {
+  int pid;
+  char name[16];
+  uint sz;                   // Size of user address space (bytes)
+  uint rss;                  // Resident user pages
+  uint ptpages;              // Page directory and page table pages
+  uint rsslimit;             // Limit on rss (pages)
+};
@@ -260,6 +260,52 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block holding file block fbn of din.  If fbn is
+// just past the end of the file, allocate it at freeblock,
+// extending the last extent when it ends there.
+uint
+xbmap(struct dinode *din, uint fbn)
+{
+  struct extent indirect[NINDEXTENT], *e;
+  uint i, start;
+
+  bzero(indirect, sizeof(indirect));
+  if(xint(din->indirect) != 0)
+    rsect(xint(din->indirect), (char*)indirect);
+
+  start = 0;
+  for(i = 0; i < NEXTENT + NINDEXTENT; i++){
+    e = i < NEXTENT ? &din->ext[i] : &indirect[i - NEXTENT];
+    if(xint(e->len) == 0)
+      break;
+    if(fbn < start + xint(e->len))
+      return xint(e->start) + fbn - start;
+    start += xint(e->len);
+  }
+  assert(fbn == start);
+
+  e = 0;
+  if(i > 0){
+    e = i-1 < NEXTENT ? &din->ext[i-1] : &indirect[i-1 - NEXTENT];
+    if(xint(e->start) + xint(e->len) == freeblock){
+      e->len = xint(xint(e->len) + 1);
+      i--;
+    } else
+      e = 0;
+  }
+  if(e == 0){
+    if(i == NEXTENT)
+      din->indirect = xint(freeblock++);
+    assert(i < NEXTENT + NINDEXTENT);
+    e = i < NEXTENT ? &din->ext[i] : &indirect[i - NEXTENT];
+    e->start = xint(freeblock);
+    e->len = xint(1);
+  }
+  if(i >= NEXTENT)
+    wsect(xint(din->indirect), (char*)indirect);
+  return freeblock++;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -267,7 +313,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -276,22 +321,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = xbmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
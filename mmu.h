@@ -83,6 +83,7 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define SUPERPGSIZE     (PGSIZE*NPTENTRIES) // bytes mapped by a PTE_PS directory entry
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
@@ -95,6 +96,12 @@ struct segdesc {
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
 #define PTE_PS          0x080   // Page Size
+#define PTE_COW         0x200   // Copy-on-write (available to software)
+
+// Page fault error code bits (trapframe err)
+#define FEC_PR          0x1     // Page fault caused by protection violation
+#define FEC_WR          0x2     // Page fault caused by a write
+#define FEC_U           0x4     // Page fault occured while in user mode
 
 
 #ifndef __ASSEMBLER__
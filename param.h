@@ -1,15 +1,46 @@
-#define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
+#define MAXPROC    4096  // maximum number of processes; fork also stops at KRESERVE free pages
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NVMSEG        2  // demand-paged executable segments per process
+#define MAXRSS    16384  // default limit on resident user pages per process (64MB)
+#define KRESERVE    256  // free pages (1MB) kept from user memory and fork for the kernel
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000 // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*12) // max data blocks in on-disk log (header fits in one block)
+#define LOGDELAY     10  // ticks a transaction collects FS system calls before it commits
+#define LOGCKPT     100  // ticks committed blocks wait in an idle log before they are installed
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define BCACHEFRAC   16  // buffer cache gets 1/BCACHEFRAC of free memory at boot
+#define NREADAHEAD    8  // blocks read ahead of sequential file reads
+#define NEXTALLOC     8  // blocks allocated at once when a file grows
+#define IOREADEXPIRE  50  // ticks a disk read may wait before it is served out of order
+#define IOWRITEEXPIRE 500 // ticks a disk write may wait before it is served out of order
+#define FSSIZE       4000 // size of file system in blocks
+#define CACHELINE      64 // cache line size (bytes), for padding per-CPU data and hot locks
+#define NMCSNODE        8 // MCS queue nodes per CPU (max spinlocks held or awaited at once)
+#define KMAXORDER      10 // largest physically contiguous allocation is 2^KMAXORDER pages
+#define NKCACHE        32 // free pages cached per CPU by kalloc
+#define KBATCH         16 // pages moved at once between a CPU's cache and the global free list
+#define NSLABCPU        8 // free objects cached per CPU by each slab cache
+#define NLOCKSTAT      64 // max distinct lock names with contention statistics
+#ifndef LOCKSTAT
+#define LOCKSTAT        1 // collect spinlock contention statistics (see lockstat.h)
+#endif
+#ifndef KJUNK
+#define KJUNK           0 // fill freed pages with junk (debugging)
+#endif
+#ifndef IOSCHED
+#define IOSCHED IOSCHED_DEADLINE // disk scheduler: IOSCHED_FIFO or IOSCHED_DEADLINE (see ide.c)
+#endif
+#ifndef IOPRIO
+#define IOPRIO          0 // serve disk requests of higher-priority (lower RSDL level) procs first
+#endif
+#ifndef SPINLOCK
+#define SPINLOCK TICKET_LOCK // spinlock implementation: XCHG_LOCK, TICKET_LOCK or MCS_LOCK (see spinlock.h)
+#endif
 
 #include "rsdl.h" // For RSDL scheduler parameters
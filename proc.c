@@ -6,18 +6,33 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "rwlock.h"
+#include "slab.h"
+#include "memstat.h"
 
 #define NULL (void *) 0x0
 
 struct {
-  struct spinlock lock;
-  struct proc proc[NPROC];
+  struct spinlock lock __attribute__((aligned(CACHELINE)));
+  // Taken for write, while holding lock, to add to procs or to change
+  // a proc's pid, parent or whether it is UNUSED. Walks that only read
+  // those take it for read instead of lock; see findproc().
+  struct rwlock rw;
+  // Every proc ever allocated, newest first. Procs are recycled through
+  // the free list but never freed or unlinked.
+  struct proc *procs;
+  struct proc *free;
+  int nproc;                   // procs that are not UNUSED, at most MAXPROC
+  struct slabcache cache;
   // pointers to start of active and expired sets
   // either active = &level[0] and expired &level[1] or vice versa
   // NOTE: Only active[0..RSDL_LEVELS-1] are correct access, ditto for expired
   struct level_queue *active;
   struct level_queue *expired;
   struct level_queue level[2][RSDL_LEVELS];
+  // number of active/expired swaps so far; procs whose epoch is older
+  // than this still hold a quantum from a previous rotation
+  uint epoch;
 } ptable;
 
 static struct proc *initproc;
@@ -60,8 +75,7 @@ void print_schedlog(void) {
       qq = &set[s][k];
       acquire(&qq->lock);
       cprintf("%d|%s|%d(%d)", ticks, set_name, k, qq->ticks_left);
-      for(int i = 0; i < qq->numproc; ++i) {
-        pp = qq->proc[i];
+      for(pp = qq->head; pp; pp = pp->qnext) {
         if (pp->state == UNUSED) continue;
         else cprintf(",[%d]%s:%d(%d)", pp->pid, pp->name, pp->state, pp->ticks_left);
       }
@@ -82,6 +96,8 @@ pinit(void)
 {
   struct level_queue *lq;
   initlock(&ptable.lock, "ptable");
+  initrwlock(&ptable.rw, "ptable.rw");
+  slabinit(&ptable.cache, "proc", sizeof(struct proc), 0);
 
   // To be sure, explicitly initialize all queues to empty
   acquire(&ptable.lock);
@@ -93,9 +109,7 @@ pinit(void)
       acquire(&lq->lock);
       lq->numproc = 0;
       lq->ticks_left = RSDL_LEVEL_QUANTUM;
-      for (int i = 0; i < NPROC; ++i){
-        lq->proc[i] = NULL;
-      }
+      lq->head = lq->tail = NULL;
       release(&lq->lock);
     }
   }
@@ -158,18 +172,27 @@ enqueue_proc(struct proc *p, struct level_queue *q)
     return;
   }
 
-  acquire(&q->lock);
-  if (q->numproc >= NPROC) {
-    panic("enqueue in full level");
-  } else {
-    // enqueue *p and increment number of procs in this level
-    q->proc[q->numproc++] = p;
+  if (p->level != NULL) {
+    panic("enqueue of proc already in a level");
+    return;
   }
+
+  acquire(&q->lock);
+  // append *p and increment number of procs in this level
+  p->level = q;
+  p->qnext = NULL;
+  p->qprev = q->tail;
+  if (q->tail)
+    q->tail->qnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+  q->numproc++;
   release(&q->lock);
 }
 
 // NOTE: *un*queue intentional since proc in middle of queue can be removed
-// returns index of proc in current level
+// returns 0, or -1 if p is not in q (panics instead unless isTry)
 int
 unqueue_proc_full(struct proc *p, struct level_queue *q, int isTry)
 {
@@ -185,36 +208,29 @@ unqueue_proc_full(struct proc *p, struct level_queue *q, int isTry)
     return -1;
   }
 
-  int found = 0;
-  int i, j;
-
-  acquire(&q->lock);
-  for (i = 0; i < q->numproc; ++i) {
-    if (q->proc[i] == p) {
-      // found proc, remove from current queue linked list
-      found = 1;
-      break;
-    }
-  }
-
-  if (found) {
-    // move succeeding procs up the queue
-    for (j = i+1; j < q->numproc; ++j) {
-      q->proc[j-1] = q->proc[j];
-    }
-    q->numproc--;   // decrement number of procs in this level
-  }
-  release(&q->lock);
-
-  if (!found) {
+  if (p->level != q) {
     if (!isTry) {
       panic("unqueue of node not belonging to level");
     }
     return -1;
   }
 
+  acquire(&q->lock);
+  if (p->qprev)
+    p->qprev->qnext = p->qnext;
+  else
+    q->head = p->qnext;
+  if (p->qnext)
+    p->qnext->qprev = p->qprev;
+  else
+    q->tail = p->qprev;
+  p->qnext = p->qprev = NULL;
+  p->level = NULL;
+  q->numproc--;   // decrement number of procs in this level
+  release(&q->lock);
+
   // we only reach here if unqueue is successful
-  return i;
+  return 0;
 }
 
 int
@@ -232,26 +248,11 @@ try_unqueue_proc(struct proc *p, struct level_queue *q)
 int
 remove_proc_from_levels(struct proc *p)
 {
-  struct level_queue *q;
-  int found = 0;
-  // Naive implementation: use linear search on each level to find level
-  for (int s = 0; s < 2; ++s) {
-    for (int k = 0; k < RSDL_LEVELS; ++k){
-      q = &ptable.level[s][k];
-      if (try_unqueue_proc(p, q) != -1) {
-        found = 1;
-        break;
-      }
-    }
-    if (found)
-      break;
-  }
-
-  if (!found) {
+  if (p->level == NULL) {
     return -1;
   }
 
-  return 0;
+  return unqueue_proc(p, p->level);
 }
 
 int
@@ -263,7 +264,7 @@ next_level(int start, int use_expired)
 
   int k = start;
   for ( ; k < RSDL_LEVELS; ++k) {
-    if (set[k].ticks_left > 0 && set[k].numproc < NPROC) {
+    if (set[k].ticks_left > 0) {
       break;
     }
   }
@@ -295,8 +296,8 @@ find_available_queue(int active_start, int expired_start)
     // re-enqueue in expired set instead, starting at expired_set
     level = next_expired_level(expired_start);
     if (level == -1) {
-      // NOTE: shouldn't happen normally
-      panic("No free level in expired and active set, too many procs");
+      // NOTE: shouldn't happen, expired levels are refilled at each swap
+      panic("No level with quantum left in expired and active set");
       return NULL;
     }
 
@@ -308,8 +309,88 @@ find_available_queue(int active_start, int expired_start)
   return &ptable.active[level];
 }
 
+// Give p a full quantum for the rotation in which q is (or will be) active.
+// Procs placed in the expired set are stamped with the next epoch so that
+// the coming set swap does not mark them stale.
+// ptable.lock must be held.
+void
+refill_proc(struct proc *p, struct level_queue *q)
+{
+  p->ticks_left = RSDL_PROC_QUANTUM;
+  p->epoch = ptable.epoch + is_expired_set(q);
+}
+
+int
+is_stale_proc(struct proc *p)
+{
+  return p->epoch < ptable.epoch;
+}
+
+// Set swaps no longer re-enqueue every proc, so a proc that slept through
+// a swap may be left in the expired set or at a lower level of the active set.
+// Move it back to its default level once it becomes RUNNABLE again;
+// its quantum is refilled lazily when it is next dispatched.
+// ptable.lock must be held.
+static void
+requeue_stale_proc(struct proc *p)
+{
+  if (!is_stale_proc(p))
+    return;
+
+  if (remove_proc_from_levels(p) == -1)
+    return;   // not in any level (e.g. not yet enqueued), nothing to move
+
+  enqueue_proc(p, find_available_queue(p->default_level, p->default_level));
+}
+
+// Level k of the active set, q, has used up its quantum: move its procs
+// to the next level with quantum left, or to the expired set, right away.
+// p, the proc that was running on this cpu, is left for the caller to
+// enqueue last; procs running on other cpus are moved when they return.
+// Together with find_available_queue() never picking a depleted level,
+// this keeps RUNNABLE procs out of depleted levels.
+// ptable.lock must be held.
+static void
+drain_level(struct level_queue *q, int k, struct proc *p)
+{
+  struct proc *np, *next;
+  struct level_queue *nq;
+
+  for (np = q->head; np; np = next) {
+    next = np->qnext;
+    if (np == p || np->state == RUNNING)
+      continue;
+    unqueue_proc(np, q);
+    // move proc to next available level in active set
+    // if none, enqueue to original level in expired set
+    nq = find_available_queue(k+1, np->default_level);
+    // moving to next level OR expired set, replenish quantum
+    refill_proc(np, nq);
+    enqueue_proc(np, nq);
+  }
+}
+
+// Return p to the free list. Its memory stays in the process table.
+// ptable.lock must be held.
+static void
+freeproc(struct proc *p)
+{
+  acquirewrite(&ptable.rw);
+  p->pid = 0;
+  p->parent = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->state = UNUSED;
+  releasewrite(&ptable.rw);
+  p->nextfree = ptable.free;
+  ptable.free = p;
+  ptable.nproc--;
+}
+
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
+// Take an UNUSED proc from the free list, or grow the
+// process table by one if there is none, up to MAXPROC procs
+// and while more than KRESERVE pages are free.
 // If found, change state to EMBRYO and initialize
 // state required to run in the kernel.
 // Otherwise return 0.
@@ -318,28 +399,46 @@ allocproc(void)
 {
   struct proc *p;
   char *sp;
+  int new;
 
   acquire(&ptable.lock);
 
-  for(p = &ptable.proc[0]; p < &ptable.proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      goto found;
+  if(ptable.nproc >= MAXPROC || kfreecount() < KRESERVE){
+    release(&ptable.lock);
+    return 0;
+  }
+  new = 0;
+  if((p = ptable.free) != 0)
+    ptable.free = p->nextfree;
+  else {
+    if((p = slaballoc(&ptable.cache)) == 0){
+      release(&ptable.lock);
+      return 0;
+    }
+    memset(p, 0, sizeof(*p));
+    new = 1;
   }
 
-  release(&ptable.lock);
-  return 0;
-
-found:
+  ptable.nproc++;
+  acquirewrite(&ptable.rw);
+  if(new){
+    p->next = ptable.procs;
+    ptable.procs = p;
+  }
   p->state = EMBRYO;
   p->pid = nextpid++;
+  releasewrite(&ptable.rw);
   p->ticks_left = RSDL_PROC_QUANTUM;
+  p->epoch = ptable.epoch;
   p->default_level = RSDL_STARTING_LEVEL;
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -361,6 +460,31 @@ found:
   return p;
 }
 
+// Start a kernel process running fn, which must never return.
+// It has no user memory and no parent, so it is never reaped.
+void
+kproc(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kproc");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kproc: out of memory?");
+  p->sz = 0;
+  p->vm.rss = 0;
+  p->vm.ptpages = 1;
+  p->vm.rsslimit = 0;
+  // forkret returns to fn instead of trapret (see allocproc).
+  *(uint*)((char*)p->context + sizeof *p->context) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  enqueue_proc(p, find_available_queue(p->default_level, p->default_level));
+  release(&ptable.lock);
+}
+
 //PAGEBREAK: 32
 // Set up first user process.
 void
@@ -374,7 +498,12 @@ userinit(void)
   initproc = p;
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
-  inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+  p->vm.rss = 0;
+  p->vm.ptpages = 1;
+  // Children inherit the limit and can only lower it. Together,
+  // processes can't take the last KRESERVE free pages (see kallocuser).
+  p->vm.rsslimit = MAXRSS;
+  inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size, &p->vm);
   p->sz = PGSIZE;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
@@ -408,15 +537,25 @@ int
 growproc(int n)
 {
   uint sz;
+  struct vmseg *s;
   struct proc *curproc = myproc();
 
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Pages are only allocated on first touch (see demandpage).
+    if(sz + n < sz || sz + n >= KERNBASE)
       return -1;
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if((sz = deallocuvm(curproc->pgdir, sz, sz + n, &curproc->vm)) == 0)
       return -1;
+    // Freed pages must come back zeroed, not reloaded from the executable.
+    for(s = curproc->seg; s < &curproc->seg[NVMSEG]; s++){
+      if(s->va >= PGROUNDUP(sz))
+        s->filesz = 0;
+      else if(s->va + s->filesz > PGROUNDUP(sz))
+        s->filesz = PGROUNDUP(sz) - s->va;
+    }
   }
   curproc->sz = sz;
   switchuvm(curproc);
@@ -450,15 +589,20 @@ priofork(int default_level)
   }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+  np->vm.rsslimit = curproc->vm.rsslimit;
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz, &np->vm)) == 0){
     kfree(np->kstack);
     np->kstack = 0;
-    np->state = UNUSED;
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
     return -1;
   }
   np->sz = curproc->sz;
-  np->parent = curproc;
   *np->tf = *curproc->tf;
+  // untouched pages are paged in by the child from the same executable
+  np->exe = curproc->exe ? idup(curproc->exe) : 0;
+  memmove(np->seg, curproc->seg, sizeof(np->seg));
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
@@ -474,6 +618,9 @@ priofork(int default_level)
 
   acquire(&ptable.lock);
 
+  acquirewrite(&ptable.rw);
+  np->parent = curproc;
+  releasewrite(&ptable.rw);
   np->default_level = default_level;  // set priority level
   np->state = RUNNABLE;
    // only enqueue here since we are sure that allocation is successful
@@ -492,6 +639,65 @@ fork(void)
   return priofork(RSDL_STARTING_LEVEL);
 }
 
+// Create a new process running the program at path, enqueued at default_level.
+// Same as priofork(default_level) followed by exec(path, argv) in the child,
+// but the child's image is loaded directly so the parent's page table is
+// never copied.
+int
+spawn(char *path, char **argv, int default_level)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  if (default_level < 0 || default_level >= RSDL_LEVELS) {
+    return -1;
+  }
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  // Registers are inherited as across fork+exec; exec sets eip and esp.
+  np->pgdir = 0;
+  np->vm.rsslimit = curproc->vm.rsslimit;
+  np->exe = 0;
+  np->sz = 0;
+  *np->tf = *curproc->tf;
+  if(execproc(np, path, argv) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    acquire(&ptable.lock);
+    freeproc(np);
+    release(&ptable.lock);
+    return -1;
+  }
+  np->tf->eax = 0;
+
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  np->cwd = idup(curproc->cwd);
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+
+  acquirewrite(&ptable.rw);
+  np->parent = curproc;
+  releasewrite(&ptable.rw);
+  np->default_level = default_level;  // set priority level
+  np->state = RUNNABLE;
+  // only enqueue here since we are sure that allocation is successful
+  struct level_queue *q = find_available_queue(np->default_level, np->default_level);
+  enqueue_proc(np, q);
+
+  release(&ptable.lock);
+
+  return pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -515,8 +721,11 @@ exit(void)
 
   begin_op();
   iput(curproc->cwd);
+  if(curproc->exe)
+    iput(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
@@ -524,13 +733,15 @@ exit(void)
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p = &ptable.proc[0]; p < &ptable.proc[NPROC]; p++){
+  acquirewrite(&ptable.rw);
+  for(p = ptable.procs; p; p = p->next){
     if(p->parent == curproc){
       p->parent = initproc;
       if(p->state == ZOMBIE)
         wakeup1(initproc);
     }
   }
+  releasewrite(&ptable.rw);
 
   // Process exited, remove from its queue
   remove_proc_from_levels(curproc);
@@ -553,8 +764,10 @@ wait(void)
   acquire(&ptable.lock);
   for(;;){
     // Scan through table looking for exited children.
+    // This stays under ptable.lock, not ptable.rw: a child turns
+    // ZOMBIE holding it, and sleep must release it atomically.
     havekids = 0;
-    for(p = &ptable.proc[0]; p < &ptable.proc[NPROC]; p++){
+    for(p = ptable.procs; p; p = p->next){
       if(p->parent != curproc)
         continue;
       havekids = 1;
@@ -564,11 +777,7 @@ wait(void)
         kfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        freeproc(p);
         release(&ptable.lock);
 
         return pid;
@@ -608,9 +817,9 @@ scheduler(void)
 
     // Loop over process table looking for process to run.
     acquire(&ptable.lock);
-    int i, prev_idx, k, nk;
+    int prev_idx, k, nk;
     int found = 0;
-    struct proc *np;
+    struct proc *np, *nnp;
     struct level_queue *nq;
     for (k = 0; k < RSDL_LEVELS; ++k) {
       q = &ptable.active[k];
@@ -618,9 +827,9 @@ scheduler(void)
         continue;
 
       acquire(&q->lock);
-      for (i = 0; i < q->numproc; ++i ) {
-        p = q->proc[i];
-        if(p->state == RUNNABLE && p->ticks_left > 0) {
+      for (p = q->head; p; p = p->qnext) {
+        // stale procs have not been refilled since the last set swap
+        if(p->state == RUNNABLE && (p->ticks_left > 0 || is_stale_proc(p))) {
           found = 1;
           break;
         }
@@ -640,6 +849,10 @@ scheduler(void)
       // before jumping back to us.
       c->proc = p;
       c->queue = q;
+      if (is_stale_proc(p)) {
+        // proc quantum refresh case 3: first dispatch since the set swap
+        refill_proc(p, q);
+      }
       switchuvm(p);
       p->state = RUNNING;
 
@@ -650,31 +863,37 @@ scheduler(void)
       swtch(&(c->scheduler), p->context);
       switchkvm();
 
-      // proc has given up control to scheduler
-      if (q->ticks_left <= 0) {
-        // level-local quantum depleted, migrate all procs
-        while (q->numproc > 0) {
-          np = q->proc[0];
-          // moving to next level OR expired set, replenish quantum
-          np->ticks_left = RSDL_PROC_QUANTUM;
+      // fold level ticks charged by trap() on this cpu into the level budget
+      // (unless sets were swapped meanwhile, which already replenished it)
+      if (!is_stale_proc(p))
+        q->ticks_left -= c->queue_ticks;
+      c->queue_ticks = 0;
 
-          unqueue_proc(np, q);
-          // Section 2.4: The active process should be enqueued last
-          if (np == p) {
-            continue;
-          }
-
-          // move proc to next available level in active set
-          // if none, enqueue to original level in expired set
-          nq = find_available_queue(k+1, np->default_level);
-          // re-enqueue to same level but in active set, or below
-          enqueue_proc(np, nq);
+      // proc has given up control to scheduler
+      if (is_stale_proc(p)) {
+        // sets were swapped while proc was running: q now belongs to the
+        // expired set, so move proc back to its default level like a waking proc
+        if (p->state != ZOMBIE && remove_proc_from_levels(p) != -1) {
+          nq = find_available_queue(p->default_level, p->default_level);
+          refill_proc(p, nq);
+          enqueue_proc(p, nq);
+        }
+        // and so would the RUNNABLE procs still waiting in q
+        for (np = q->head; np; np = nnp) {
+          nnp = np->qnext;
+          if (np->state == RUNNABLE)
+            requeue_stale_proc(np);
         }
+      } else if (q->ticks_left <= 0) {
+        // level-local quantum depleted, migrate all procs
+        drain_level(q, k, p);
 
         // If proc called exit, it already unqueued itself; no need to re-enqueue
         if (p->state != ZOMBIE) {
-          // active process is the last process to be enqueued
+          // Section 2.4: The active process should be enqueued last
+          unqueue_proc(p, q);
           nq = find_available_queue(k+1, p->default_level);
+          refill_proc(p, nq);
           enqueue_proc(p, nq);
         }
       } else {
@@ -682,9 +901,10 @@ scheduler(void)
         //       replenished and reprioritized, so we only do things below
         //       when the level still has remaining quantum
         // Check if we need to replenish quantum or move to lower priority queue
+        int refill = 0;
         if (p->ticks_left <= 0) {
           // proc used up quantum: enqueue to lower priority
-          p->ticks_left = RSDL_PROC_QUANTUM;
+          refill = 1;
           nk = k + 1;
         } else {
           // proc yielded with remaining quantum: re-enqueue to same level
@@ -701,9 +921,10 @@ scheduler(void)
           // find vacant queue, starting from level nk as decided above
           // if no available level in active set, enqueue to original level in expired set
           nq = find_available_queue(nk, p->default_level);
-          if (is_expired_set(nq)) {
+          if (refill || is_expired_set(nq)) {
+            // proc quantum refresh case 1: proc used up quantum
             // proc quantum refresh case 2: proc moved to expired set
-            p->ticks_left = RSDL_PROC_QUANTUM;
+            refill_proc(p, nq);
           }
           enqueue_proc(p, nq);
         }
@@ -719,23 +940,16 @@ scheduler(void)
       nq = ptable.active;
       ptable.active = ptable.expired;
       ptable.expired = nq;
-
-      // re-enqueue procs in old active set (expired set) to new active set
+      ptable.epoch++;
+
+      // Procs left in the old active set (now expired) are not touched here,
+      // so the swap costs O(levels). None of them is RUNNABLE: levels with
+      // quantum left had none, and depleted levels were drained when they
+      // depleted (see drain_level()). They are sleeping or running on another
+      // cpu, and are moved back to their default level when they wake up or
+      // return to the scheduler. See requeue_stale_proc() and is_stale_proc().
       for (k = 0; k < RSDL_LEVELS; ++k) {
-        q = &ptable.expired[k];
-        q->ticks_left = RSDL_LEVEL_QUANTUM; // replenish level-local quantum
-        while (q->numproc > 0) {
-          p = q->proc[0];
-          // proc will be re-enqueued to new level, replenish quantum
-          p->ticks_left = RSDL_PROC_QUANTUM;
-          unqueue_proc(p, q);
-
-          // re-enqueue to original level in active set
-          // if no available level in active set, enqueue to original level in expired set
-          nk = p->default_level;
-          nq = find_available_queue(nk, nk);
-          enqueue_proc(p, nq);
-        }
+        ptable.expired[k].ticks_left = RSDL_LEVEL_QUANTUM; // replenish level-local quantum
       }
     }
     release(&ptable.lock);
@@ -847,9 +1061,11 @@ wakeup1(void *chan)
 {
   struct proc *p;
 
-  for(p = &ptable.proc[0]; p < &ptable.proc[NPROC]; p++){
-    if(p->state == SLEEPING && p->chan == chan)
+  for(p = ptable.procs; p; p = p->next){
+    if(p->state == SLEEPING && p->chan == chan){
       p->state = RUNNABLE;
+      requeue_stale_proc(p);
+    }
   }
 }
 
@@ -862,6 +1078,25 @@ wakeup(void *chan)
   release(&ptable.lock);
 }
 
+// Look up the process with the given pid without taking ptable.lock.
+// The slot may be reused by the time the caller looks at it, so
+// callers that modify it must recheck p->pid holding ptable.lock.
+// Returns 0 if there is no such process.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  acquireread(&ptable.rw);
+  for(p = ptable.procs; p; p = p->next){
+    if(p->pid == pid && p->state != UNUSED)
+      break;
+  }
+  releaseread(&ptable.rw);
+
+  return p;
+}
+
 // Kill the process with the given pid.
 // Process won't exit until it returns
 // to user space (see trap in trap.c).
@@ -870,25 +1105,81 @@ kill(int pid)
 {
   struct proc *p;
 
+  // Only take ptable.lock once there is something to kill.
+  if((p = findproc(pid)) == 0)
+    return -1;
+
   acquire(&ptable.lock);
-  for(p = &ptable.proc[0]; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  if(p->pid != pid || p->state == UNUSED){
+    // exited and was reaped since findproc
+    release(&ptable.lock);
+    return -1;
+  }
+  p->killed = 1;
+  // Wake process from sleep if necessary.
+  if(p->state == SLEEPING){
+    p->state = RUNNABLE;
+    requeue_stale_proc(p);
   }
   release(&ptable.lock);
-  return -1;
+  return 0;
+}
+
+// Copy memory statistics of up to n processes to user address st.
+// Returns the number of records copied, or -1.
+int
+memstat(struct memstat *st, int n)
+{
+  struct memstat *buf;
+  struct proc *p;
+  int i;
+
+  // Gather into a kernel page and copy out after releasing
+  // ptable.rw, since copyout may have to allocate.
+  if(n > PGSIZE/sizeof(*buf))
+    n = PGSIZE/sizeof(*buf);
+  if((buf = (struct memstat*)kalloc()) == 0)
+    return -1;
+  i = 0;
+  acquireread(&ptable.rw);
+  for(p = ptable.procs; p && i < n; p = p->next){
+    if(p->state == UNUSED || p->state == EMBRYO)
+      continue;
+    buf[i].pid = p->pid;
+    safestrcpy(buf[i].name, p->name, sizeof(buf[i].name));
+    buf[i].sz = p->sz;
+    buf[i].rss = p->vm.rss;
+    buf[i].ptpages = p->vm.ptpages;
+    buf[i].rsslimit = p->vm.rsslimit;
+    i++;
+  }
+  releaseread(&ptable.rw);
+  if(copyout(myproc()->pgdir, (uint)st, buf, i*sizeof(*buf)) < 0)
+    i = -1;
+  kfree((char*)buf);
+  return i;
+}
+
+// Lower the current process's limit on resident user pages,
+// which its children inherit. The limit can't be raised again,
+// so a parent can confine what it runs. npages <= 0 leaves it alone.
+// Returns the old limit.
+int
+rsslimit(int npages)
+{
+  struct proc *curproc = myproc();
+  int old;
+
+  old = curproc->vm.rsslimit;
+  if(npages > 0 && npages < old)
+    curproc->vm.rsslimit = npages;
+  return old;
 }
 
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
-// No lock to avoid wedging a stuck machine further.
+// Only ptable.rw, not ptable.lock, to avoid wedging a stuck machine further.
 void
 procdump(void)
 {
@@ -905,7 +1196,8 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = &ptable.proc[0]; p < &ptable.proc[NPROC]; p++){
+  acquireread(&ptable.rw);
+  for(p = ptable.procs; p; p = p->next){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -920,4 +1212,5 @@ procdump(void)
     }
     cprintf("\n");
   }
+  releaseread(&ptable.rw);
 }
@@ -1,14 +1,17 @@
 #include "spinlock.h"
 
-// NOTE: each level is represented as an array with NPROC elements
-//       for simplicity (since the previous linke list approach had a lot of mysterious crashes)
+// Each level is a FIFO list threaded through its procs (p->qnext, p->qprev),
+// so levels take no space per possible proc and any number of procs fit.
+// Each level starts on its own cache line so that CPUs working on
+// different levels do not false-share locks and counters.
 struct level_queue {
   struct spinlock lock;
   // must only be modified by enqueue_proc and unqueue_proc
   int numproc;
-  int ticks_left;
-  struct proc *proc[NPROC];
-};
+  int ticks_left;              // level budget; per-CPU charges are folded in by scheduler()
+  struct proc *head;           // first proc to run
+  struct proc *tail;
+} __attribute__((aligned(CACHELINE)));
 
 // Per-CPU state
 struct cpu {
@@ -21,7 +24,11 @@ struct cpu {
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
   struct level_queue *queue;   // level queue where proc can be found
-};
+  int queue_ticks;             // ticks charged to queue but not yet folded into its ticks_left
+#if SPINLOCK == MCS_LOCK
+  struct mcsnode mcs[NMCSNODE]; // queue nodes for MCS spinlocks (see spinlock.c)
+#endif
+} __attribute__((aligned(CACHELINE)));  // no false sharing between cpus[i]
 
 extern struct cpu cpus[NCPU];
 extern int ncpu;
@@ -47,10 +54,26 @@ struct context {
 
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// Part of the executable that is read into user memory
+// a page at a time, on first touch (see demandpage in vm.c).
+struct vmseg {
+  uint va;                     // First user virtual address (page aligned)
+  uint off;                    // Offset of va in the executable
+  uint filesz;                 // Bytes from va backed by the file; 0 if unused
+};
+
+// Memory use of a user address space, kept up to date by vm.c.
+struct vmstat {
+  uint rss;                    // Present user pages (shared copy-on-write pages count in each)
+  uint ptpages;                // Page directory and user page table pages
+  uint rsslimit;               // Max rss; allocating user pages beyond it fails
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
+  struct vmstat vm;            // Memory use of pgdir
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
   int pid;                     // Process ID
@@ -61,9 +84,17 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Executable, for demand paging
+  struct vmseg seg[NVMSEG];    // File-backed parts of user memory
   char name[16];               // Process name (debugging)
   int ticks_left;              // Remaining process quantum (in ticks)
   int default_level;           // starting level for initial run and during swapping of sets
+  uint epoch;                  // set rotation in which ticks_left was last refilled
+  struct level_queue *level;   // level queue p is enqueued in, or 0
+  struct proc *qnext;          // next and previous proc in that level
+  struct proc *qprev;
+  struct proc *next;           // next in ptable's list of all procs
+  struct proc *nextfree;       // next UNUSED proc, if p is UNUSED
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,93 @@
+// Reader-writer spin locks.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "rwlock.h"
+
+void
+initrwlock(struct rwlock *lk, char *name)
+{
+  lk->name = name;
+  lk->readers = 0;
+  lk->writer = 0;
+  lk->cpu = 0;
+}
+
+void
+acquireread(struct rwlock *lk)
+{
+  pushcli(); // disable interrupts to avoid deadlock.
+  if(holdingwrite(lk))
+    panic("acquireread");
+
+  for(;;){
+    while(lk->writer)
+      pause();
+    __sync_fetch_and_add(&lk->readers, 1);
+    if(!lk->writer)
+      break;
+    // A writer got in first; let it go ahead.
+    __sync_fetch_and_sub(&lk->readers, 1);
+  }
+
+  // Critical section loads must happen after the lock is acquired.
+  __sync_synchronize();
+}
+
+void
+releaseread(struct rwlock *lk)
+{
+  if(lk->readers == 0)
+    panic("releaseread");
+
+  __sync_synchronize();
+  __sync_fetch_and_sub(&lk->readers, 1);
+  popcli();
+}
+
+void
+acquirewrite(struct rwlock *lk)
+{
+  pushcli(); // disable interrupts to avoid deadlock.
+  if(holdingwrite(lk))
+    panic("acquirewrite");
+
+  // Claim the writer flag first, which stops new readers,
+  // then wait for the current readers to drain.
+  while(xchg(&lk->writer, 1) != 0)
+    pause();
+  while(lk->readers != 0)
+    pause();
+
+  __sync_synchronize();
+  lk->cpu = mycpu();
+}
+
+void
+releasewrite(struct rwlock *lk)
+{
+  if(!holdingwrite(lk))
+    panic("releasewrite");
+
+  lk->cpu = 0;
+  __sync_synchronize();
+  asm volatile("movl $0, %0" : "+m" (lk->writer) : );
+  popcli();
+}
+
+// Check whether this cpu is holding the lock for writing.
+int
+holdingwrite(struct rwlock *lk)
+{
+  int r;
+  pushcli();
+  r = lk->writer && lk->cpu == mycpu();
+  popcli();
+  return r;
+}
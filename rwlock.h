@@ -0,0 +1,12 @@
+// Reader-writer spin lock, for read-mostly data.
+// Many readers or one writer may hold it; a waiting writer keeps new
+// readers out so it can't be starved. Not recursive, and like a
+// spinlock it must not be held across sleep().
+struct rwlock {
+  volatile uint readers;  // Number of readers holding the lock
+  volatile uint writer;   // Is a writer holding or waiting for the lock?
+
+  // For debugging:
+  char *name;             // Name of lock.
+  struct cpu *cpu;        // The cpu holding the lock for writing.
+};
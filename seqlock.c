@@ -0,0 +1,54 @@
+// Sequence locks.
+//
+// Reader:
+//   do {
+//     s = readseqbegin(&lk);
+//     ... copy the data ...
+//   } while(readseqretry(&lk, s));
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "x86.h"
+#include "seqlock.h"
+
+void
+initseqlock(struct seqlock *lk)
+{
+  lk->seq = 0;
+}
+
+// Start an update. Caller must hold the lock serializing writers.
+void
+writeseqbegin(struct seqlock *lk)
+{
+  lk->seq++;
+  __sync_synchronize();
+}
+
+void
+writeseqend(struct seqlock *lk)
+{
+  __sync_synchronize();
+  lk->seq++;
+}
+
+// Start a read, waiting out a write in progress.
+uint
+readseqbegin(struct seqlock *lk)
+{
+  uint s;
+
+  while((s = lk->seq) & 1)
+    pause();
+  __sync_synchronize();
+  return s;
+}
+
+// Did a write happen since readseqbegin returned s?
+int
+readseqretry(struct seqlock *lk, uint s)
+{
+  __sync_synchronize();
+  return lk->seq != s;
+}
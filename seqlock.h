@@ -0,0 +1,7 @@
+// Sequence lock, for small data that is read far more often than written.
+// Writers must already be serialized by another lock (e.g. ptable.lock) and
+// bump seq around their update; readers never block writers, they just
+// retry if seq changed or was odd (write in progress) while they read.
+struct seqlock {
+  volatile uint seq;   // Odd while a write is in progress
+};
@@ -0,0 +1,182 @@
+// Slab allocator for small fixed-size kernel objects.
+// Objects handed back by slabfree() are not reinitialized: the
+// constructor only runs when a new slab page is carved up, so users
+// must leave freed objects in their constructed state. Free objects
+// are tracked by index in the slab header, never inside the object.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct slab *next;            // In cache's partial or full list
+  struct slab *prev;
+  uint nfree;                   // Number of entries in free[]
+  ushort free[];                // Indices of free objects
+};
+
+// Objects start at the first multiple of 16 past the header
+// and its free[] array of n entries.
+#define SLABHDR(n) ((sizeof(struct slab) + (n)*sizeof(ushort) + 15) & ~15)
+
+void
+slabinit(struct slabcache *c, char *name, uint size, void (*ctor)(void*))
+{
+  uint n;
+
+  size = (size + 7) & ~7;
+  if(size == 0 || size > PGSIZE - SLABHDR(1))
+    panic("slabinit");
+  n = (PGSIZE - sizeof(struct slab)) / (size + sizeof(ushort));
+  while(SLABHDR(n) + n*size > PGSIZE)
+    n--;
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->perslab = n;
+  c->objoff = SLABHDR(n);
+  c->ctor = ctor;
+  c->partial = 0;
+  c->full = 0;
+  memset(c->cpu, 0, sizeof(c->cpu));
+}
+
+static void
+unlinkslab(struct slab **list, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+static void
+pushslab(struct slab **list, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *list;
+  if(s->next)
+    s->next->prev = s;
+  *list = s;
+}
+
+// Allocate and construct a new slab page. Called without c->lock,
+// since constructors may take locks of their own.
+static struct slab*
+newslab(struct slabcache *c)
+{
+  struct slab *s;
+  char *p;
+  uint i;
+
+  if((p = kalloc()) == 0)
+    return 0;
+  s = (struct slab*)p;
+  for(i = 0; i < c->perslab; i++){
+    if(c->ctor)
+      c->ctor(p + c->objoff + i*c->size);
+    s->free[i] = c->perslab - 1 - i;
+  }
+  s->nfree = c->perslab;
+  return s;
+}
+
+// Take one free object from the slabs. Caller holds c->lock.
+static void*
+getobj(struct slabcache *c)
+{
+  struct slab *s;
+  uint i;
+
+  if((s = c->partial) == 0)
+    return 0;
+  i = s->free[--s->nfree];
+  if(s->nfree == 0){
+    unlinkslab(&c->partial, s);
+    pushslab(&c->full, s);
+  }
+  return (char*)s + c->objoff + i*c->size;
+}
+
+// Return an object to its slab, giving the page back to kalloc
+// if the whole slab is free and another partial slab exists.
+// Caller holds c->lock.
+static void
+putobj(struct slabcache *c, void *v)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)v);
+  s->free[s->nfree] = ((char*)v - (char*)s - c->objoff) / c->size;
+  if(s->nfree++ == 0){
+    unlinkslab(&c->full, s);
+    pushslab(&c->partial, s);
+  }
+  if(s->nfree == c->perslab && (s->next || s->prev)){
+    unlinkslab(&c->partial, s);
+    kfree((char*)s);
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if the memory cannot be allocated.
+void*
+slaballoc(struct slabcache *c)
+{
+  struct slabcpu *sc;
+  struct slab *s;
+  void *v;
+
+  pushcli();
+  sc = &c->cpu[cpuid()];
+  if(sc->n == 0){
+    // Refill half of this CPU's cache from the slabs.
+    acquire(&c->lock);
+    while(sc->n < NSLABCPU/2){
+      if(c->partial == 0){
+        release(&c->lock);
+        s = newslab(c);
+        acquire(&c->lock);
+        if(s == 0)
+          break;
+        pushslab(&c->partial, s);
+      }
+      sc->obj[sc->n++] = getobj(c);
+    }
+    release(&c->lock);
+  }
+  v = sc->n > 0 ? sc->obj[--sc->n] : 0;
+  popcli();
+  return v;
+}
+
+// Free object v, which was allocated from cache c.
+void
+slabfree(struct slabcache *c, void *v)
+{
+  struct slabcpu *sc;
+  int i;
+
+  if(v == 0 || ((uint)v - PGROUNDDOWN((uint)v) - c->objoff) % c->size)
+    panic("slabfree");
+
+  pushcli();
+  sc = &c->cpu[cpuid()];
+  if(sc->n == NSLABCPU){
+    // Drain the older half back to the slabs.
+    acquire(&c->lock);
+    for(i = 0; i < NSLABCPU/2; i++)
+      putobj(c, sc->obj[i]);
+    release(&c->lock);
+    memmove(sc->obj, sc->obj + NSLABCPU/2, (NSLABCPU - NSLABCPU/2) * sizeof(sc->obj[0]));
+    sc->n -= NSLABCPU/2;
+  }
+  sc->obj[sc->n++] = v;
+  popcli();
+}
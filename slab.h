@@ -0,0 +1,20 @@
+// Cache of equally sized kernel objects, carved out of kalloc() pages.
+// Each page (a slab) starts with a struct slab header followed by as
+// many objects as fit. Every CPU keeps a few free objects of its own so
+// most slaballoc/slabfree calls don't take the cache lock.
+struct slabcpu {
+  int n;                        // Number of objects in obj[]
+  void *obj[NSLABCPU];          // Free objects cached by this CPU
+} __attribute__((aligned(CACHELINE)));
+
+struct slabcache {
+  struct spinlock lock;         // Protects the slab lists
+  char *name;                   // Name of cache, for debugging
+  uint size;                    // Object size in bytes
+  uint perslab;                 // Objects per slab page
+  uint objoff;                  // Offset of first object in a slab page
+  void (*ctor)(void*);          // Called once per object when its slab is made
+  struct slab *partial;         // Slabs with some free objects
+  struct slab *full;            // Slabs with no free objects
+  struct slabcpu cpu[NCPU];
+};
@@ -8,6 +8,141 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "lockstat.h"
+
+#if LOCKSTAT
+// Contention statistics, one record per lock name. See lockstat.h.
+struct lockstat lockstats[NLOCKSTAT];
+// Guards registration in lockstats[]. Not a spinlock since
+// initlock() would have to register it too.
+static uint lockstatbusy;
+// Guards the site table of lockstats[i], which locks with the same
+// name update from several cpus at once.
+static uint sitebusy[NLOCKSTAT];
+
+// Find or add the statistics record for name.
+// Returns 0 if the table is full; such locks are not profiled.
+static struct lockstat*
+lockstatfor(char *name)
+{
+  struct lockstat *ls;
+
+  while(xchg(&lockstatbusy, 1) != 0)
+    pause();
+  for(ls = lockstats; ls < &lockstats[NLOCKSTAT]; ls++){
+    if(ls->name[0] == 0){
+      safestrcpy(ls->name, name, sizeof(ls->name));
+      break;
+    }
+    if(strncmp(ls->name, name, sizeof(ls->name)) == 0)
+      break;
+  }
+  xchg(&lockstatbusy, 0);
+
+  if(ls == &lockstats[NLOCKSTAT])
+    return 0;
+  return ls;
+}
+
+// Account for an acquisition of lk, which is now held.
+// start is when the caller began spinning, if contended.
+static void
+statacquire(struct spinlock *lk, int contended, uint64 start)
+{
+  struct lockstat *ls = lk->stat;
+  uint64 now = rdtsc();
+  int i, min;
+
+  lk->tstamp = now;
+  if(ls == 0)
+    return;
+
+  // Other locks with the same name may be held on other cpus.
+  __sync_fetch_and_add(&ls->nacquire, 1);
+  if(!contended)
+    return;
+  __sync_fetch_and_add(&ls->ncontended, 1);
+  __sync_fetch_and_add(&ls->spin, now - start);
+
+  // Charge the caller of acquire(); if it is not tracked yet,
+  // it replaces the site with the fewest contended acquisitions.
+  // If another cpu is updating the table, drop this sample
+  // rather than spin in the profiler.
+  if(xchg(&sitebusy[ls - lockstats], 1) != 0)
+    return;
+  min = 0;
+  for(i = 0; i < NLOCKSITE; i++){
+    if(ls->sitepc[i] == lk->pcs[0])
+      break;
+    if(ls->sitecnt[i] < ls->sitecnt[min])
+      min = i;
+  }
+  if(i == NLOCKSITE){
+    i = min;
+    ls->sitepc[i] = lk->pcs[0];
+    ls->sitecnt[i] = 0;
+  }
+  ls->sitecnt[i]++;
+  xchg(&sitebusy[ls - lockstats], 0);
+}
+
+// Account for the hold time of lk, which is about to be released.
+static void
+statrelease(struct spinlock *lk)
+{
+  struct lockstat *ls = lk->stat;
+  uint64 hold, old;
+
+  if(ls == 0)
+    return;
+  hold = rdtsc() - lk->tstamp;
+  do {
+    old = ls->maxhold;
+  } while(hold > old && !__sync_bool_compare_and_swap(&ls->maxhold, old, hold));
+}
+
+// Copy up to n lock statistics records to user address st.
+// Returns the number of records copied, or -1.
+int
+lockstat(struct lockstat *st, int n)
+{
+  struct lockstat *buf;
+  uint order;
+  int i;
+
+  // Gather into kernel pages and copy out from there, since
+  // copyout may have to allocate and other cpus keep updating
+  // lockstats[].
+  for(order = 0; (PGSIZE << order) < sizeof(lockstats); order++)
+    ;
+  if(n > NLOCKSTAT)
+    n = NLOCKSTAT;
+  if((buf = (struct lockstat*)kallocpages(order)) == 0)
+    return -1;
+  for(i = 0; i < n && lockstats[i].name[0]; i++)
+    buf[i] = lockstats[i];
+  if(copyout(myproc()->pgdir, (uint)st, buf, i*sizeof(*buf)) < 0)
+    i = -1;
+  kfreepages((char*)buf, order);
+  return i;
+}
+#else
+static void
+statacquire(struct spinlock *lk, int contended, uint64 start)
+{
+}
+
+static void
+statrelease(struct spinlock *lk)
+{
+}
+
+int
+lockstat(struct lockstat *st, int n)
+{
+  return -1;
+}
+#endif
 
 void
 initlock(struct spinlock *lk, char *name)
@@ -15,8 +150,40 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+#if SPINLOCK == TICKET_LOCK
+  lk->next = 0;
+  lk->owner = 0;
+#elif SPINLOCK == MCS_LOCK
+  lk->tail = 0;
+  lk->node = 0;
+#endif
+#if LOCKSTAT
+  lk->stat = lockstatfor(name);
+#else
+  lk->stat = 0;
+#endif
+  lk->tstamp = 0;
 }
 
+#if SPINLOCK == MCS_LOCK
+// Take a free queue node of this cpu. Interrupts must be off.
+static struct mcsnode*
+mcsalloc(void)
+{
+  struct mcsnode *n;
+
+  for(n = mycpu()->mcs; n < &mycpu()->mcs[NMCSNODE]; n++){
+    if(!n->inuse){
+      n->inuse = 1;
+      n->next = 0;
+      n->wait = 1;
+      return n;
+    }
+  }
+  panic("mcsalloc");
+}
+#endif
+
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 // Holding a lock for a long time may cause
@@ -24,13 +191,44 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  int contended = 0;
+  uint64 start = 0;
+
   pushcli(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
+#if SPINLOCK == TICKET_LOCK
+  // Take a ticket and wait for our turn; waiters get the lock in FIFO order.
+  uint ticket = __sync_fetch_and_add(&lk->next, 1);
+  if(lk->owner != ticket){
+    contended = 1;
+    start = rdtsc();
+    while(lk->owner != ticket)
+      pause();
+  }
+#elif SPINLOCK == MCS_LOCK
+  // Append our node to the queue and spin on it until
+  // the previous holder hands the lock over.
+  struct mcsnode *n = mcsalloc();
+  struct mcsnode *prev = (struct mcsnode*)xchg((uint*)&lk->tail, (uint)n);
+  if(prev){
+    contended = 1;
+    start = rdtsc();
+    prev->next = n;
+    while(n->wait)
+      pause();
+  }
+  lk->node = n;
+#else
   // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  if(xchg(&lk->locked, 1) != 0){
+    contended = 1;
+    start = rdtsc();
+    while(xchg(&lk->locked, 1) != 0)
+      pause();
+  }
+#endif
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -38,8 +236,10 @@ acquire(struct spinlock *lk)
   __sync_synchronize();
 
   // Record info about lock acquisition for debugging.
+  lk->locked = 1;
   lk->cpu = mycpu();
   getcallerpcs(&lk, lk->pcs);
+  statacquire(lk, contended, start);
 }
 
 // Release the lock.
@@ -49,9 +249,14 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  statrelease(lk);
   lk->pcs[0] = 0;
   lk->cpu = 0;
 
+#if SPINLOCK == TICKET_LOCK || SPINLOCK == MCS_LOCK
+  lk->locked = 0;
+#endif
+
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that all the stores in the critical
   // section are visible to other cores before the lock is released.
@@ -59,10 +264,28 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
+#if SPINLOCK == TICKET_LOCK
+  // Only the holder writes owner, so a plain store hands the lock
+  // to the next ticket.
+  lk->owner = lk->owner + 1;
+#elif SPINLOCK == MCS_LOCK
+  struct mcsnode *n = lk->node;
+  if(n->next == 0){
+    // No known waiter: free the lock unless someone is just queueing up.
+    if(__sync_bool_compare_and_swap(&lk->tail, n, 0))
+      goto done;
+    while(n->next == 0)
+      pause();
+  }
+  n->next->wait = 0;
+done:
+  n->inuse = 0;
+#else
   // Release the lock, equivalent to lk->locked = 0.
   // This code can't use a C assignment, since it might
   // not be atomic. A real OS would use C atomics here.
   asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+#endif
 
   popcli();
 }
@@ -1,14 +1,40 @@
 #ifndef SPINLOCK_H
 #define SPINLOCK_H
+// Spinlock implementations, selected at build time by SPINLOCK in param.h
+// (or e.g. make SPINLOCK=MCS_LOCK):
+//   XCHG_LOCK    test-and-set on a single word, no fairness
+//   TICKET_LOCK  FIFO ticket lock, waiters spin on the shared owner counter
+//   MCS_LOCK     FIFO queue lock, each waiter spins on its own per-CPU node
+#define XCHG_LOCK    1
+#define TICKET_LOCK  2
+#define MCS_LOCK     3
+
+// MCS queue node. Each cpu has NMCSNODE of them (see struct cpu),
+// one for every spinlock it may hold or wait for at the same time.
+struct mcsnode {
+  struct mcsnode *volatile next;  // next waiter in queue
+  volatile uint wait;             // spin while non-zero
+  uint inuse;                     // node is owned by a held/awaited lock
+};
+
 // Mutual exclusion lock.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held? (the lock word itself for XCHG_LOCK)
+
+#if SPINLOCK == TICKET_LOCK
+  volatile uint next;   // next ticket to hand out
+  volatile uint owner;  // ticket currently allowed to hold the lock
+#elif SPINLOCK == MCS_LOCK
+  struct mcsnode *volatile tail;  // last waiter, or 0 if lock is free
+  struct mcsnode *node;           // queue node of the holder
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
   uint pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+  struct lockstat *stat; // Contention statistics for this lock's name.
+  uint64 tstamp;     // When the lock was acquired (rdtsc).
 };
 #endif
-
@@ -21,6 +21,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(faultin(curproc, addr, 4, 0) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +41,8 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && faultin(curproc, (uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -65,6 +69,12 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  // Fault lazily allocated pages in now; the caller may
+  // access them holding locks, where a page fault can't sleep.
+  // The caller may also write them (e.g. read), so unshare
+  // copy-on-write pages now too, failing if out of memory.
+  if(faultin(curproc, i, size, 1) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -107,6 +117,10 @@ extern int sys_yield(void);
 extern int sys_shutdown(void);
 extern int sys_schedlog(void);
 extern int sys_priofork(void);
+extern int sys_lockstat(void);
+extern int sys_spawn(void);
+extern int sys_memstat(void);
+extern int sys_rsslimit(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -134,6 +148,10 @@ static int (*syscalls[])(void) = {
 [SYS_shutdown] sys_shutdown,
 [SYS_schedlog] sys_schedlog,
 [SYS_priofork] sys_priofork,
+[SYS_lockstat] sys_lockstat,
+[SYS_spawn]   sys_spawn,
+[SYS_memstat] sys_memstat,
+[SYS_rsslimit] sys_rsslimit,
 };
 
 void
@@ -24,3 +24,7 @@
 #define SYS_shutdown  23
 #define SYS_schedlog  24
 #define SYS_priofork  25
+#define SYS_lockstat  26
+#define SYS_spawn     27
+#define SYS_memstat   28
+#define SYS_rsslimit  29
@@ -393,19 +393,17 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the null-terminated user array of strings at uargv into argv,
+// which has room for MAXARG pointers.
+static int
+fetchargv(uint uargv, char **argv)
 {
-  char *path, *argv[MAXARG];
   int i;
-  uint uargv, uarg;
+  uint uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -416,9 +414,39 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+  uint uargv;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
   return exec(path, argv);
 }
 
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  uint uargv;
+  int default_level;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0 ||
+     argint(2, &default_level) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+  return spawn(path, argv, default_level);
+}
+
 int
 sys_pipe(void)
 {
@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "lockstat.h"
+#include "memstat.h"
 
 int
 sys_fork(void)
@@ -108,6 +110,7 @@ sys_yield(void)
 
 int sys_shutdown(void)
 {
+  log_sync();
   shutdown();
   return 0;
 }
@@ -122,3 +125,44 @@ int sys_schedlog(void)
   schedlog(n);
   return 0;
 }
+
+int sys_lockstat(void)
+{
+  struct lockstat *st;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NLOCKSTAT)
+    n = NLOCKSTAT;
+  if(argptr(0, (void*)&st, n*sizeof(*st)) < 0)
+    return -1;
+
+  return lockstat(st, n);
+}
+
+int
+sys_memstat(void)
+{
+  struct memstat *st;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > PGSIZE/sizeof(*st))  // memstat() copies out at most a page
+    n = PGSIZE/sizeof(*st);
+  if(argptr(0, (void*)&st, n*sizeof(*st)) < 0)
+    return -1;
+
+  return memstat(st, n);
+}
+
+int
+sys_rsslimit(void)
+{
+  int npages;
+
+  if(argint(0, &npages) < 0)
+    return -1;
+  return rsslimit(npages);
+}
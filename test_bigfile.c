@@ -0,0 +1,132 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+
+#define NBLOCK 200  // more than the old 140-block limit
+#define WORDS (BSIZE / sizeof(uint))
+
+static uint buf[WORDS];
+
+static void
+fill(uint b)
+{
+    for (uint j = 0; j < WORDS; j++)
+        buf[j] = b * WORDS + j;
+}
+
+// "test_bigfile w" writes bigfile and shuts down; shutdown commits the
+// log but leaves it to be installed by recovery at the next boot, where
+// "test_bigfile r" reads it back. "test_bigfile max" writes up to MAXFILE.
+static void
+writebig(void)
+{
+    int fd;
+
+    unlink("bigfile");
+    if ((fd = open("bigfile", O_CREATE | O_WRONLY)) < 0) {
+        printf(1, "test_bigfile: FAIL, cannot create bigfile\n");
+        return;
+    }
+    for (uint b = 0; b < NBLOCK; b++) {
+        fill(b);
+        if (write(fd, buf, BSIZE) != BSIZE) {
+            printf(1, "test_bigfile: FAIL, write of block %d\n", b);
+            close(fd);
+            return;
+        }
+    }
+    close(fd);
+    printf(1, "test_bigfile: wrote %d blocks, run test_bigfile r after reboot\n", NBLOCK);
+}
+
+static void
+readbig(void)
+{
+    struct stat st;
+    int fd;
+
+    if ((fd = open("bigfile", O_RDONLY)) < 0) {
+        printf(1, "test_bigfile: FAIL, no bigfile; run test_bigfile w first\n");
+        return;
+    }
+    if (fstat(fd, &st) < 0 || st.size != NBLOCK * BSIZE) {
+        printf(1, "test_bigfile: FAIL, size %d, want %d\n", st.size, NBLOCK * BSIZE);
+        close(fd);
+        return;
+    }
+    for (uint b = 0; b < NBLOCK; b++) {
+        if (read(fd, buf, BSIZE) != BSIZE) {
+            printf(1, "test_bigfile: FAIL, read of block %d\n", b);
+            close(fd);
+            return;
+        }
+        for (uint j = 0; j < WORDS; j++) {
+            if (buf[j] != b * WORDS + j) {
+                printf(1, "test_bigfile: FAIL, block %d word %d is %d\n", b, j, buf[j]);
+                close(fd);
+                return;
+            }
+        }
+    }
+    if (read(fd, buf, BSIZE) != 0)
+        printf(1, "test_bigfile: FAIL, data past the end\n");
+    else
+        printf(1, "test_bigfile: OK, %d blocks intact\n", NBLOCK);
+    close(fd);
+    unlink("bigfile");
+}
+
+// Fill a file to MAXFILE blocks. A write that crosses the limit
+// returns only the part written before it, the next one fails.
+static void
+writemax(void)
+{
+    static char big[4 * BSIZE];
+    struct stat st;
+    int fd, n;
+
+    unlink("maxfile");
+    if ((fd = open("maxfile", O_CREATE | O_WRONLY)) < 0) {
+        printf(1, "test_bigfile: FAIL, cannot create maxfile\n");
+        return;
+    }
+    for (int b = 0; b < MAXFILE - 4; b++) {
+        if (write(fd, big, BSIZE) != BSIZE) {
+            printf(1, "test_bigfile: FAIL, write of block %d\n", b);
+            goto out;
+        }
+    }
+    n = write(fd, big, sizeof(big));
+    if (n <= 0 || n >= (int)sizeof(big)) {
+        printf(1, "test_bigfile: FAIL, write across MAXFILE returned %d\n", n);
+        goto out;
+    }
+    if ((n = write(fd, big, sizeof(big))) != -1) {
+        printf(1, "test_bigfile: FAIL, write past MAXFILE returned %d\n", n);
+        goto out;
+    }
+    if (fstat(fd, &st) < 0 || st.size > MAXFILE * BSIZE) {
+        printf(1, "test_bigfile: FAIL, size %d past MAXFILE\n", st.size);
+        goto out;
+    }
+    printf(1, "test_bigfile: OK, writes stop at %d of %d bytes\n", st.size, MAXFILE * BSIZE);
+out:
+    close(fd);
+    unlink("maxfile");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 2 && strcmp(argv[1], "w") == 0) {
+        writebig();
+        shutdown();
+    }
+    if (argc == 2 && strcmp(argv[1], "r") == 0)
+        readbig();
+    else if (argc == 2 && strcmp(argv[1], "max") == 0)
+        writemax();
+    else
+        printf(2, "usage: test_bigfile w|r|max\n");
+    shutdown();
+}
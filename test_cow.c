@@ -0,0 +1,147 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "mmu.h"
+
+#define NPAGE 16  // pages of buf, shared copy-on-write by every fork
+
+static char *buf;
+
+static int
+intact(void)
+{
+    for (int i = 0; i < NPAGE; i++)
+        if (buf[i * PGSIZE] != (char)i || buf[i * PGSIZE + PGSIZE - 1] != (char)i)
+            return 0;
+    return 1;
+}
+
+// Take fresh pages until the next one can't be had, by the rsslimit
+// or because memory ran out, and report how many. The pages are
+// faulted in by fstat writing to them, which fails instead of
+// killing us. Then hold them until hold is closed.
+static void
+hog(int report, int hold)
+{
+    struct stat *st;
+    int n;
+    char c;
+
+    for (n = 0; ; n++) {
+        st = (struct stat*)sbrk(PGSIZE);
+        if (st == (struct stat*)-1 || fstat(1, st) < 0)
+            break;
+    }
+    write(report, &n, sizeof(n));
+    read(hold, &c, 1);
+    exit();
+}
+
+// Runs in a child sharing buf: start hogs until memory runs out,
+// then unshare a page of buf, first in a system call, which must
+// fail, then by writing to it, which must kill us.
+static void
+oom(int res, int hold)
+{
+    int fds[2], n, limit, r;
+
+    limit = rsslimit(0);
+    for (;;) {
+        if (pipe(fds) < 0 || (r = fork()) < 0)
+            break;  // no memory left even for the kernel's share
+        if (r == 0) {
+            close(fds[0]);
+            close(res);
+            hog(fds[1], hold);
+        }
+        close(fds[1]);
+        if (read(fds[0], &n, sizeof(n)) != sizeof(n))
+            n = 0;  // killed unsharing its stack
+        close(fds[0]);
+        if (n < limit - NPAGE - 64)
+            break;  // stopped short of its limit: out of memory
+    }
+
+    r = fstat(1, (struct stat*)buf);
+    write(res, &r, sizeof(r));
+    buf[0] = 'x';
+    r = 0;
+    write(res, &r, sizeof(r));
+    exit();
+}
+
+int main() {
+    int res[2], hold[2], r, pid;
+
+    buf = sbrk(NPAGE * PGSIZE);
+    for (int i = 0; i < NPAGE; i++)
+        memset(buf + i * PGSIZE, i, PGSIZE);
+
+    // A child sees the parent's pages, and its writes stay its own.
+    if ((pid = fork()) == 0) {
+        if (!intact())
+            printf(1, "test_cow: FAIL, child does not see the parent's data\n");
+        for (int i = 0; i < NPAGE; i++)
+            buf[i * PGSIZE] = 'x';
+        exit();
+    }
+    if (pid < 0) {
+        printf(1, "test_cow: FAIL, fork\n");
+        shutdown();
+    }
+    wait();
+    if (!intact()) {
+        printf(1, "test_cow: FAIL, child's writes reached the parent\n");
+        shutdown();
+    }
+
+    if (pipe(res) < 0 || pipe(hold) < 0) {
+        printf(1, "test_cow: pipe failed\n");
+        shutdown();
+    }
+    if ((pid = fork()) == 0) {
+        close(res[0]);
+        close(hold[1]);
+        oom(res[1], hold[0]);
+    }
+    close(res[1]);
+    close(hold[0]);
+
+    if (read(res[0], &r, sizeof(r)) != sizeof(r))
+        printf(1, "test_cow: FAIL, child died before unsharing out of memory\n");
+    else if (r != -1)
+        printf(1, "test_cow: FAIL, system call unshared a page out of memory\n");
+    else if (read(res[0], &r, sizeof(r)) == sizeof(r))
+        printf(1, "test_cow: FAIL, child wrote a shared page out of memory\n");
+    wait();
+    close(hold[1]);  // release the hogs, which init reaps
+    close(res[0]);
+
+    if (!intact()) {
+        printf(1, "test_cow: FAIL, parent's data changed\n");
+        shutdown();
+    }
+    // Once the hogs are gone a child can fork and unshare buf again.
+    if (pipe(res) < 0) {
+        printf(1, "test_cow: pipe failed\n");
+        shutdown();
+    }
+    for (int tries = 0; tries < 100 && (pid = fork()) < 0; tries++)
+        sleep(1);
+    if (pid == 0) {
+        for (int tries = 0; tries < 100 && (r = fstat(1, (struct stat*)buf)) < 0; tries++)
+            sleep(1);
+        write(res[1], &r, sizeof(r));
+        exit();
+    }
+    close(res[1]);
+    if (pid < 0)
+        printf(1, "test_cow: FAIL, fork after out of memory\n");
+    else if (read(res[0], &r, sizeof(r)) != sizeof(r) || r < 0)
+        printf(1, "test_cow: FAIL, unsharing after out of memory\n");
+    else
+        printf(1, "test_cow: OK\n");
+    wait();
+
+    shutdown();
+}
@@ -0,0 +1,41 @@
+#include "types.h"
+#include "user.h"
+
+#define NCHILD 200  // well past the old fixed table of 64 procs
+
+// Keep NCHILD children alive at once, blocked on a pipe,
+// then let them all exit and reap them.
+int main() {
+    int fds[2], n, i;
+    char c;
+
+    if (pipe(fds) < 0) {
+        printf(1, "test_nproc: pipe failed\n");
+        shutdown();
+    }
+    for (n = 0; n < NCHILD; n++) {
+        int pid = fork();
+        if (pid < 0)
+            break;
+        if (pid == 0) {
+            close(fds[1]);
+            read(fds[0], &c, 1);  // returns 0 once the parent closes its end
+            exit();
+        }
+    }
+    close(fds[1]);
+
+    for (i = 0; i < n; i++) {
+        if (wait() < 0) {
+            printf(1, "test_nproc: FAIL, wait stopped after %d of %d children\n", i, n);
+            shutdown();
+        }
+    }
+
+    if (n < NCHILD)
+        printf(1, "test_nproc: FAIL, fork failed after %d children\n", n);
+    else
+        printf(1, "test_nproc: OK, %d children alive at once\n", n);
+
+    shutdown();
+}
@@ -0,0 +1,41 @@
+#include "types.h"
+#include "user.h"
+#include "mmu.h"
+
+#define LIMIT 64  // resident pages allowed to the child
+
+// A child with a lowered rsslimit touches twice that many fresh sbrk
+// pages and reports each one; it must be killed before it gets there.
+int main() {
+    int fds[2], n, last;
+    char *p;
+
+    if (pipe(fds) < 0) {
+        printf(1, "test_rss: pipe failed\n");
+        shutdown();
+    }
+    if (fork() == 0) {
+        close(fds[0]);
+        rsslimit(LIMIT);
+        // sbrk is lazy: the pages count against the limit when touched
+        p = sbrk(2 * LIMIT * PGSIZE);
+        for (n = 0; n < 2 * LIMIT; n++) {
+            p[n * PGSIZE] = 1;
+            write(fds[1], &n, sizeof(n));
+        }
+        exit();
+    }
+    close(fds[1]);
+
+    last = -1;
+    while (read(fds[0], &n, sizeof(n)) == sizeof(n))
+        last = n;
+    wait();
+
+    if (last + 1 >= LIMIT)
+        printf(1, "test_rss: FAIL, child touched %d pages with a limit of %d\n", last + 1, LIMIT);
+    else
+        printf(1, "test_rss: OK, child killed after %d pages with a limit of %d\n", last + 1, LIMIT);
+
+    shutdown();
+}
@@ -11,7 +11,7 @@
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
-struct spinlock tickslock;
+struct spinlock tickslock __attribute__((aligned(CACHELINE)));
 uint ticks;
 
 void
@@ -78,6 +78,18 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // First touch of a lazily allocated or demand-loaded user page.
+    if(myproc() && !(tf->err & FEC_PR) && demandpage(myproc(), rcr2()) == 0)
+      break;
+    // Write to a page shared copy-on-write since fork. System calls
+    // unshare user buffers before writing them (see argptr, copyout),
+    // so out of memory fails the call instead of faulting here.
+    if(myproc() && (tf->err & FEC_WR) && cowcopy(myproc()->pgdir, rcr2()) == 0)
+      break;
+    // Otherwise a genuine fault, handled below.
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -109,8 +121,12 @@ trap(struct trapframe *tf)
     if (!mycpu()->queue)
       panic("Running process located outside active/expired set.");
 
+    // Level ticks are charged to this cpu only and folded into the
+    // shared level budget by scheduler() once the proc gives up the cpu,
+    // so timer interrupts on several cpus don't write the same cache line.
+    struct cpu *c = mycpu();
     int proc_ticks = --myproc()->ticks_left;
-    int level_ticks = --mycpu()->queue->ticks_left;
+    int level_ticks = c->queue->ticks_left - ++c->queue_ticks;
     if (proc_ticks <= 0 || level_ticks <= 0){
       yield();
     }
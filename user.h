@@ -1,6 +1,8 @@
 #include "param.h"
 struct stat;
 struct rtcdate;
+struct lockstat;
+struct memstat;
 
 // system calls
 int fork(void);
@@ -28,6 +30,10 @@ int yield(void);
 int shutdown(void);
 int schedlog(int);
 int priofork(int);
+int lockstat(struct lockstat*, int);
+int spawn(char*, char**, int);
+int memstat(struct memstat*, int);
+int rsslimit(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -1374,8 +1374,8 @@ iref(void)
 }
 
 // test that fork fails gracefully
-// the forktest binary also does this, but it runs out of proc entries first.
-// inside the bigger usertests binary, we run out of memory first.
+// the forktest binary also does this. fork stops at MAXPROC procs or
+// when free memory reaches the kernel's reserve, whichever comes first.
 void
 forktest(void)
 {
@@ -1383,7 +1383,7 @@ forktest(void)
 
   printf(1, "fork test\n");
 
-  for(n=0; n<1000; n++){
+  for(n=0; n<MAXPROC; n++){
     pid = fork();
     if(pid < 0)
       break;
@@ -1391,8 +1391,8 @@ forktest(void)
       exit();
   }
 
-  if(n == 1000){
-    printf(1, "fork claimed to work 1000 times!\n");
+  if(n == MAXPROC){
+    printf(1, "fork claimed to work %d times!\n", MAXPROC);
     exit();
   }
 
@@ -56,21 +56,28 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned.
+// be page-aligned. New page tables and pages are counted in vs,
+// unless it is 0 (kernel mappings).
 static int
-mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm, struct vmstat *vs)
 {
   char *a, *last;
   pte_t *pte;
+  int newpt;
 
   a = (char*)PGROUNDDOWN((uint)va);
   last = (char*)PGROUNDDOWN(((uint)va) + size - 1);
   for(;;){
+    newpt = !(pgdir[PDX(a)] & PTE_P);
     if((pte = walkpgdir(pgdir, a, 1)) == 0)
       return -1;
     if(*pte & PTE_P)
       panic("remap");
     *pte = pa | perm | PTE_P;
+    if(vs){
+      vs->ptpages += newpt;
+      vs->rss++;
+    }
     if(a == last)
       break;
     a += PGSIZE;
@@ -79,6 +86,34 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Like mappages, but map every 4MB-aligned stretch of the range
+// with a single PTE_PS entry in the page directory instead of a
+// page table. Only used for the kernel's part of the address space.
+static int
+mapkpages(pde_t *pgdir, uint va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  while(size > 0){
+    if(va % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 && size >= SUPERPGSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+      n = SUPERPGSIZE;
+    } else {
+      n = SUPERPGSIZE - va % SUPERPGSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, (void*)va, n, pa, perm, 0) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -99,6 +134,9 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
+//
+// Above the first 4MB (which holds the read-only kernel text) the
+// kernel mappings use 4MB pages, so they need no page tables.
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
@@ -115,32 +153,39 @@ static struct kmap {
 };
 
 // Set up kernel part of a page table.
+// The kernel mappings never change after boot, so every page
+// directory just copies kpgdir's entries above KERNBASE and
+// shares its kernel page tables.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memset(pgdir, 0, PDX(KERNBASE)*sizeof(pde_t));
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE))*sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes. Its kernel half is the one
+// shared by all page tables (see setupkvm).
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if((kpgdir = (pde_t*)kalloc()) == 0)
+    panic("kvmalloc");
+  memset(kpgdir, 0, PGSIZE);
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkpages(kpgdir, (uint)k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -180,7 +225,7 @@ switchuvm(struct proc *p)
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
-inituvm(pde_t *pgdir, char *init, uint sz)
+inituvm(pde_t *pgdir, char *init, uint sz, struct vmstat *vs)
 {
   char *mem;
 
@@ -188,7 +233,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
     panic("inituvm: more than a page");
   mem = kalloc();
   memset(mem, 0, PGSIZE);
-  mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
+  mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U, vs);
   memmove(mem, init, sz);
 }
 
@@ -217,9 +262,10 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
 }
 
 // Allocate page tables and physical memory to grow process from oldsz to
-// newsz, which need not be page aligned.  Returns new size or 0 on error.
+// newsz, which need not be page aligned.  Returns new size or 0 on error,
+// including when the new pages would take vs->rss past vs->rsslimit.
 int
-allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+allocuvm(pde_t *pgdir, uint oldsz, uint newsz, struct vmstat *vs)
 {
   char *mem;
   uint a;
@@ -231,16 +277,20 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if(vs->rss >= vs->rsslimit){
+      deallocuvm(pgdir, newsz, oldsz, vs);
+      return 0;
+    }
+    mem = kallocuser();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
-      deallocuvm(pgdir, newsz, oldsz);
+      deallocuvm(pgdir, newsz, oldsz, vs);
       return 0;
     }
     memset(mem, 0, PGSIZE);
-    if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U, vs) < 0){
       cprintf("allocuvm out of memory (2)\n");
-      deallocuvm(pgdir, newsz, oldsz);
+      deallocuvm(pgdir, newsz, oldsz, vs);
       kfree(mem);
       return 0;
     }
@@ -252,8 +302,9 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
+// Freed pages are uncounted from vs, if not 0.
 int
-deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+deallocuvm(pde_t *pgdir, uint oldsz, uint newsz, struct vmstat *vs)
 {
   pte_t *pte;
   uint a, pa;
@@ -273,6 +324,8 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+      if(vs)
+        vs->rss--;
     }
   }
   return newsz;
@@ -287,8 +340,9 @@ freevm(pde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
-  deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  deallocuvm(pgdir, KERNBASE, 0, 0);
+  // Kernel page tables are shared with kpgdir; only free the user ones.
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -310,10 +364,88 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Map a zeroed page at the not yet present user address va of p,
+// filled from p's executable if va lies in one of its segments.
+// User memory below p->sz is only allocated here, on first touch:
+// growproc() and exec() just set p->sz.
+// Returns -1 if va is not a lazily allocated page or out of memory.
+int
+demandpage(struct proc *p, uint va)
+{
+  pte_t *pte;
+  struct vmseg *s;
+  uint a, start, end;
+  char *mem;
+
+  if(va >= p->sz || p->vm.rss >= p->vm.rsslimit)
+    return -1;
+  a = PGROUNDDOWN(va);
+  if((pte = walkpgdir(p->pgdir, (char*)a, 0)) != 0 && (*pte & PTE_P))
+    return -1;
+
+  if((mem = kallocuser()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  for(s = p->seg; s < &p->seg[NVMSEG]; s++){
+    if(s->filesz == 0 || a + PGSIZE <= s->va || a >= s->va + s->filesz)
+      continue;
+    start = a < s->va ? s->va : a;
+    end = a + PGSIZE < s->va + s->filesz ? a + PGSIZE : s->va + s->filesz;
+    ilock(p->exe);
+    if(readi(p->exe, mem + (start - a), s->off + (start - s->va), end - start) != end - start){
+      iunlock(p->exe);
+      kfree(mem);
+      return -1;
+    }
+    iunlock(p->exe);
+  }
+  if(mappages(p->pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U, &p->vm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Make the user pages of p covering [va, va+len) present, and
+// private if the kernel is going to write them, so that it never
+// takes a copy-on-write fault it could not recover from.
+// System calls do this for user buffers before they take locks
+// that a page fault could not sleep under.
+int
+faultin(struct proc *p, uint va, uint len, int write)
+{
+  uint a, last;
+  pte_t *pte;
+
+  if(len == 0)
+    return 0;
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + len - 1);
+  for(;;){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if((pte == 0 || !(*pte & PTE_P)) && demandpage(p, a) < 0)
+      return -1;
+    if(write && (pte = walkpgdir(p->pgdir, (char*)a, 0)) != 0 &&
+       (*pte & PTE_COW) && cowcopy(p->pgdir, a) < 0)
+      return -1;
+    if(a == last)
+      break;
+    a += PGSIZE;
+  }
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
 // of it for a child.
+// User pages are not copied: parent and child share them read-only
+// and marked PTE_COW until one of them writes (see cowcopy).
+// Pages without PTE_U (the stack guard page) are still copied.
+// Pages that were never touched stay unmapped; the child
+// faults them in itself (see demandpage).
+// The copy's memory use is counted in vs, and may not exceed
+// vs->rsslimit.
 pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+copyuvm(pde_t *pgdir, uint sz, struct vmstat *vs)
 {
   pde_t *d;
   pte_t *pte;
@@ -322,25 +454,80 @@ copyuvm(pde_t *pgdir, uint sz)
 
   if((d = setupkvm()) == 0)
     return 0;
+  vs->rss = 0;
+  vs->ptpages = 1;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
+    if(vs->rss >= vs->rsslimit)
+      goto bad;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
+    if(!(flags & PTE_U)){
+      if((mem = kalloc()) == 0)
+        goto bad;
+      memmove(mem, (char*)P2V(pa), PGSIZE);
+      if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags, vs) < 0) {
+        kfree(mem);
+        goto bad;
+      }
+      continue;
     }
+    if(flags & PTE_W){
+      flags = (flags & ~PTE_W) | PTE_COW;
+      *pte = pa | flags;
+    }
+    if(mappages(d, (void*)i, PGSIZE, pa, flags, vs) < 0)
+      goto bad;
+    kincref(P2V(pa));
   }
+  // The parent may have cached writable translations of the pages
+  // that are now copy-on-write.
+  lcr3(rcr3());
   return d;
 
 bad:
   freevm(d);
+  lcr3(rcr3());
+  return 0;
+}
+
+// Give pgdir its own writable copy of the copy-on-write page
+// containing va. Called on write faults and before the kernel
+// writes to user pages through their physical address.
+// Returns -1 if va is not a copy-on-write page or out of memory.
+int
+cowcopy(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa, flags;
+  char *mem;
+
+  if(va >= KERNBASE)
+    return -1;
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefcount(P2V(pa)) == 1){
+    // Every other sharer already made its copy; just take the page back.
+    *pte = pa | flags;
+  } else {
+    if((mem = kallocuser()) == 0)
+      return -1;
+    memmove(mem, P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    kfree(P2V(pa));
+  }
+  if(V2P(pgdir) == rcr3())
+    lcr3(V2P(pgdir));
   return 0;
 }
 
@@ -367,10 +554,16 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    // The write below goes through the kernel mapping and would
+    // bypass copy-on-write, so unshare the page first.
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowcopy(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
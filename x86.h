@@ -130,6 +130,22 @@ xchg(volatile uint *addr, uint newval)
   return result;
 }
 
+// Read the time-stamp counter (cycles since reset).
+static inline uint64
+rdtsc(void)
+{
+  uint64 val;
+  asm volatile("rdtsc" : "=A" (val));
+  return val;
+}
+
+// Spin-wait hint: lets a spinning cpu back off the lock's cache line.
+static inline void
+pause(void)
+{
+  asm volatile("pause");
+}
+
 static inline uint
 rcr2(void)
 {
@@ -138,6 +154,14 @@ rcr2(void)
   return val;
 }
 
+static inline uint
+rcr3(void)
+{
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r" (val));
+  return val;
+}
+
 static inline void
 lcr3(uint val)
 {